@@ -0,0 +1,118 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// Compare NativeFunc::call in a loop with NativeFunc::callBatch, for
+// functions with 1, 4 and 8 scalar arguments.
+//
+// Usage: bench_call_batch [N]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+namespace {
+
+template <class F>
+double timeit(F const& Func)
+{
+  auto Start = std::chrono::steady_clock::now();
+  Func();
+  auto End = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(End-Start).count();
+}
+
+void bench(CompilationUnit& CU, const char* Name, size_t N)
+{
+  NativeFunc F = CU.getFunction(Name);
+  auto const& Params = F.getType()->getParams();
+  const auto Layout = F.getType()->getFrameLayout();
+
+  // Frames and pointers to the arguments of each call
+  std::vector<ArgsFrame> Frames;
+  std::vector<void*> FramePtrs;
+  std::vector<void*> ArgPtrs;
+  Frames.reserve(N);
+  FramePtrs.reserve(N);
+  ArgPtrs.reserve(N*Params.size());
+  for (size_t I = 0; I < N; ++I) {
+    Frames.emplace_back(F.newFrame());
+    auto& Frame = Frames.back();
+    for (size_t A = 0; A < Params.size(); ++A) {
+      Frame.set<int>(A, (int)(I+A));
+      ArgPtrs.push_back(Frame.getArgPtr(A));
+    }
+    FramePtrs.push_back(Frame.data());
+  }
+  std::vector<int> Rets(N);
+
+  const double TCall = timeit([&]() {
+    for (size_t I = 0; I < N; ++I) {
+      F.call(&Rets[I], &ArgPtrs[I*Params.size()]);
+    }
+  });
+  const double TFrame = timeit([&]() {
+    for (size_t I = 0; I < N; ++I) {
+      F.callFrame(&Rets[I], FramePtrs[I]);
+    }
+  });
+  // First call compiles the batch trampoline
+  F.callBatch(Rets.data(), sizeof(int), FramePtrs.data(), 1);
+  const double TBatch = timeit([&]() {
+    F.callBatch(Rets.data(), sizeof(int), FramePtrs.data(), N);
+  });
+
+  std::cout << Name << " (" << Params.size() << " args, frame of " << Layout.Size << " bytes)" << std::endl;
+  std::cout << "  call:      " << TCall << " ms" << std::endl;
+  std::cout << "  callFrame: " << TFrame << " ms" << std::endl;
+  std::cout << "  callBatch: " << TBatch << " ms" << std::endl;
+}
+
+} // anonymous
+
+int main(int argc, char** argv)
+{
+  const size_t N = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+int f1(int a) { return a+1; }
+int f4(int a, int b, int c, int d) { return a+b*c-d; }
+int f8(int a, int b, int c, int d, int e, int f, int g, int h) { return a+b+c+d+e+f+g+h; }
+)",
+  Err);
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  bench(CU, "f1", N);
+  bench(CU, "f4", N);
+  bench(CU, "f8", N);
+  return 0;
+}
@@ -0,0 +1,188 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "alloc.h"
+#include "errors.h"
+
+namespace {
+
+// Pooled buffers are rounded up to a multiple of PoolGranularity, and
+// aligned on it.
+constexpr size_t PoolGranularity = 16;
+// Maximum number of free buffers kept for a size class
+constexpr size_t PoolMaxFree = 256;
+
+// Free lists of the pool, indexed by size class. They are only accessed with
+// the GIL held.
+std::vector<std::vector<void*>>& getPool()
+{
+  // Leaked, as objects can be destroyed during the interpreter shutdown.
+  static auto* Pool = new std::vector<std::vector<void*>>{};
+  return *Pool;
+}
+
+size_t roundUp(size_t V, size_t Align)
+{
+  return (V + Align - 1) / Align * Align;
+}
+
+void* allocAligned(size_t Size, size_t Align)
+{
+#ifdef _WIN32
+  void* Ret = _aligned_malloc(Size, Align);
+#else
+  void* Ret;
+  if (posix_memalign(&Ret, Align, Size) != 0) {
+    Ret = nullptr;
+  }
+#endif
+  if (!Ret) {
+    throw AllocError{"allocation failure!"};
+  }
+  return Ret;
+}
+
+void freeAligned(void* Ptr)
+{
+#ifdef _WIN32
+  _aligned_free(Ptr);
+#else
+  free(Ptr);
+#endif
+}
+
+#ifndef _WIN32
+size_t getPageSize()
+{
+  static const size_t PageSize = sysconf(_SC_PAGESIZE);
+  return PageSize;
+}
+#endif
+
+void* allocRaw(size_t Size, size_t Align, AllocKind& Kind)
+{
+  auto const& Policy = getAllocPolicy();
+#ifndef _WIN32
+  if (Policy.HugePagesThreshold && Size >= Policy.HugePagesThreshold && Align <= getPageSize()) {
+    const size_t Len = roundUp(Size, getPageSize());
+    void* Ret = mmap(nullptr, Len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Ret != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+      // This is only a hint, and it is fine if it fails
+      madvise(Ret, Len, MADV_HUGEPAGE);
+#endif
+      Kind = AllocKind::Mmap;
+      return Ret;
+    }
+  }
+#endif
+  if (Policy.PoolMaxSize && Size <= Policy.PoolMaxSize && Size > 0 && Align <= PoolGranularity) {
+    const size_t Class = roundUp(Size, PoolGranularity) / PoolGranularity;
+    auto& Pool = getPool();
+    if (Class < Pool.size() && !Pool[Class].empty()) {
+      void* Ret = Pool[Class].back();
+      Pool[Class].pop_back();
+      Kind = AllocKind::Pool;
+      return Ret;
+    }
+    void* Ret = allocAligned(Class*PoolGranularity, PoolGranularity);
+    Kind = AllocKind::Pool;
+    return Ret;
+  }
+  void* Ret = allocAligned(Size, Align);
+  Kind = AllocKind::Malloc;
+  return Ret;
+}
+
+} // anonymous
+
+AllocPolicy& getAllocPolicy()
+{
+  static AllocPolicy Policy;
+  return Policy;
+}
+
+void* allocData(size_t Size, size_t Align, bool Initialize, AllocPolicy::InitKind DefaultInit, AllocKind& Kind)
+{
+  auto const& Policy = getAllocPolicy();
+  Align = std::max({Align, sizeof(void*), Policy.Align});
+  if (Align & (Align - 1)) {
+    ThrowError<AllocError>() << "alignment " << Align << " isn't a power of two!";
+  }
+  void* Ret = allocRaw(Size, Align, Kind);
+  if (!Initialize) {
+    return Ret;
+  }
+  switch (Policy.Init == AllocPolicy::Default ? DefaultInit : Policy.Init) {
+    case AllocPolicy::Default:
+    case AllocPolicy::Uninitialized:
+      break;
+    case AllocPolicy::Zero:
+      // Mapped memory is already zeroed
+      if (Kind != AllocKind::Mmap) {
+        memset(Ret, 0, Size);
+      }
+      break;
+    case AllocPolicy::Pattern:
+      memset(Ret, Policy.PatternByte, Size);
+      break;
+  };
+  return Ret;
+}
+
+void releaseData(void* Ptr, size_t Size, AllocKind Kind)
+{
+  switch (Kind) {
+    case AllocKind::Malloc:
+      freeAligned(Ptr);
+      break;
+    case AllocKind::Mmap:
+#ifndef _WIN32
+    {
+      // File mappings can start in the middle of a page
+      const size_t Delta = (uintptr_t)Ptr % getPageSize();
+      munmap((uint8_t*)Ptr - Delta, roundUp(Size + Delta, getPageSize()));
+    }
+#endif
+      break;
+    case AllocKind::Pool:
+    {
+      const size_t Class = roundUp(Size, PoolGranularity) / PoolGranularity;
+      auto& Pool = getPool();
+      if (Class >= Pool.size()) {
+        Pool.resize(Class+1);
+      }
+      if (Pool[Class].size() < PoolMaxFree) {
+        Pool[Class].push_back(Ptr);
+      }
+      else {
+        freeAligned(Ptr);
+      }
+      break;
+    }
+  };
+}
@@ -0,0 +1,66 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_ALLOC_H
+#define PYDFFI_ALLOC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Allocation policy of the data of the arrays, structures and unions created
+// from python. It is global to the process.
+struct AllocPolicy
+{
+  enum InitKind: uint8_t {
+    // Historical behaviour: arrays are filled with PatternByte, and
+    // structures/unions are left uninitialized
+    Default,
+    Uninitialized,
+    Zero,
+    Pattern
+  };
+
+  InitKind Init = Default;
+  uint8_t PatternByte = 0xDD;
+  // Minimal alignment. The alignment of the type (and at least the one of
+  // pointers) is always respected.
+  size_t Align = 0;
+  // Buffers of at least this size are directly mapped from the system, and
+  // transparent huge pages are requested for them. 0 disables it. This is
+  // ignored on Windows.
+  size_t HugePagesThreshold = 0;
+  // Buffers up to this size are recycled through per size class free lists.
+  // 0 disables it.
+  size_t PoolMaxSize = 0;
+};
+
+AllocPolicy& getAllocPolicy();
+
+// How an allocated buffer must be released
+enum class AllocKind: uint8_t {
+  Malloc,
+  // Anonymous or file mapping
+  Mmap,
+  Pool
+};
+
+// Allocates Size bytes aligned on at least Align, following the current
+// policy. DefaultInit is the initialization used with AllocPolicy::Default.
+// If Initialize is false, the initialization requested by the policy is
+// skipped (for buffers that are entirely written right after).
+void* allocData(size_t Size, size_t Align, bool Initialize, AllocPolicy::InitKind DefaultInit, AllocKind& Kind);
+void releaseData(void* Ptr, size_t Size, AllocKind Kind);
+
+#endif
@@ -0,0 +1,81 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_ARENA_H
+#define PYDFFI_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Thread-local bump allocator for the temporary objects of a call. Memory is
+// released by resetting the arena to a mark taken before the allocations, so
+// that nested calls (e.g. from python callbacks) only release their own
+// objects. Blocks are kept from one call to another.
+class CallArena
+{
+public:
+  struct Mark
+  {
+    size_t Block;
+    size_t Offset;
+  };
+
+  static CallArena& get()
+  {
+    static thread_local CallArena Arena;
+    return Arena;
+  }
+
+  Mark mark() const { return Mark{Cur_, Off_}; }
+  void release(Mark M)
+  {
+    Cur_ = M.Block;
+    Off_ = M.Offset;
+  }
+
+  void* allocate(size_t Size, size_t Align)
+  {
+    assert(Size <= BlockSize && "object too big for the call arena!");
+    assert(Align <= alignof(std::max_align_t) && "unsupported alignment!");
+    while (true) {
+      if (Cur_ == Blocks_.size()) {
+        Blocks_.emplace_back(new char[BlockSize]);
+      }
+      const size_t Off = (Off_ + Align - 1) & ~(Align - 1);
+      if (Off + Size <= BlockSize) {
+        Off_ = Off + Size;
+        return Blocks_[Cur_].get() + Off;
+      }
+      ++Cur_;
+      Off_ = 0;
+    }
+  }
+
+private:
+  CallArena():
+    Cur_(0),
+    Off_(0)
+  { }
+
+  static constexpr size_t BlockSize = 4096;
+
+  std::vector<std::unique_ptr<char[]>> Blocks_;
+  size_t Cur_;
+  size_t Off_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# Sort an array with the libc's qsort, using a python comparison function
+# through a JIT-compiled closure, and compare it with a native comparison
+# function.
+#
+# Usage: python qsort.py [N]
+
+import sys
+import random
+import time
+import pydffi
+
+N = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stdlib.h>
+
+typedef int(*cmp_ty)(const void*, const void*);
+
+void sort(int* a, size_t n, cmp_ty cmp) {
+  qsort(a, n, sizeof(int), cmp);
+}
+
+int cmp_native(const void* a, const void* b) {
+  const int va = *(const int*)a;
+  const int vb = *(const int*)b;
+  return (va > vb) - (va < vb);
+}
+''')
+
+Int32Ty = F.basicType(pydffi.BasicKind.Int32)
+IntPtrTy = F.ptr(Int32Ty)
+ArrTy = F.arrayType(Int32Ty, N)
+
+def gen_data():
+    random.seed(0)
+    data = ArrTy()
+    for i in range(N):
+        data.set(i, random.randint(-(1<<31), (1<<31)-1))
+    return data
+
+def cmp_py(a, b):
+    a = a.cast(IntPtrTy).obj.value
+    b = b.cast(IntPtrTy).obj.value
+    return (a > b) - (a < b)
+
+sort = CU.funcs.sort
+CmpTy = CU.types.cmp_ty.pointee()
+
+def bench(name, cmp):
+    data = gen_data()
+    start = time.time()
+    sort(F.ptr(data).cast(IntPtrTy), N, cmp)
+    end = time.time()
+    for i in range(1, min(N, 1000)):
+        assert(data.get(i-1) <= data.get(i))
+    print("%s: %0.4fs" % (name, end-start))
+
+bench("native comparator", F.ptr(CU.funcs.cmp_native))
+bench("python comparator", CmpTy.closure(cmp_py))
@@ -12,7 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cctype>
+#include <climits>
 #include <cstdlib>
+#include <limits>
+#include <map>
+#include <type_traits>
+#include <unordered_map>
 #include "cobj.h"
 #include "dispatcher.h"
 #include "errors.h"
@@ -61,6 +68,12 @@ struct ValueSetter
     memcpy(Ptr, ArrayObj.getData(), Ty->getSize());
   }
 
+  static void case_vector(VectorType const* Ty, void* Ptr, py::handle Obj)
+  {
+    CVectorObj const& VectorObj = Obj.cast<CVectorObj const&>();
+    memcpy(Ptr, VectorObj.getData(), Ty->getSize());
+  }
+
   static void case_func(FunctionType const* Ty, void* Ptr, py::handle Obj)
   {
     // This should never happen, as this is prevented by the C standard!
@@ -92,8 +105,7 @@ struct ValueGetter
   template <class T, class CT>
   static py::object case_composite_impl(CT const* Ty, void* Ptr)
   {
-    auto* Ret = new T{*Ty, Data<void>::view(Ptr)};
-    return py::cast(Ret, py::return_value_policy::take_ownership);
+    return toPyObject(std::unique_ptr<CObj>{new T{*Ty, Data<void>::view(Ptr)}});
   }
 
   static py::object case_composite(StructType const* Ty, void* Ptr)
@@ -112,6 +124,12 @@ struct ValueGetter
     return py::cast(Ret, py::return_value_policy::take_ownership);
   }
 
+  static py::object case_vector(VectorType const* Ty, void* Ptr)
+  {
+    auto* Ret = new CVectorObj{*Ty, Data<void>::view(Ptr)};
+    return py::cast(Ret, py::return_value_policy::take_ownership);
+  }
+
   static py::object case_func(FunctionType const* Ty, void* Ptr)
   {
     // This should never happen, as this is prevented by the C standard!
@@ -154,6 +172,11 @@ struct PtrToObjView
     return std::unique_ptr<CObj>{new CArrayObj{*Ty, Data<void>::view(Ptr)}};
   }
 
+  static std::unique_ptr<CObj> case_vector(VectorType const* Ty, void* Ptr)
+  {
+    return std::unique_ptr<CObj>{new CVectorObj{*Ty, Data<void>::view(Ptr)}};
+  }
+
   static std::unique_ptr<CObj> case_func(FunctionType const* Ty, void* Ptr)
   {
     auto NF = Ty->getFunction(Ptr);
@@ -161,9 +184,27 @@ struct PtrToObjView
   }
 };
 
+// A buffer matches a pointer if its elements have the pointee layout, or, for
+// pointers to (nested) arrays, if its inner dimensions are the array ones.
+bool bufferMatchesPointee(py::buffer_info const& Info, Type const* PteTy)
+{
+  if (formatMatches(Info, PteTy)) {
+    return true;
+  }
+  Type const* Ty = PteTy;
+  ssize_t Dim = 1;
+  while (auto* ATy = dffi::dyn_cast<dffi::ArrayType>(Ty)) {
+    if (Dim >= Info.ndim || static_cast<uint64_t>(Info.shape[Dim]) != ATy->getNumElements()) {
+      return false;
+    }
+    Ty = ATy->getElementType();
+    ++Dim;
+  }
+  return Dim > 1 && Dim == Info.ndim && formatMatches(Info, Ty);
+}
+
 struct ConvertArgsSwitch
 {
-  typedef std::vector<std::unique_ptr<CObj>> ObjsHolder;
   typedef std::vector<py::object> PyObjsHolder;
 
   static CObj* checkType(CObj* O, Type const* Ty)
@@ -181,9 +222,7 @@ struct ConvertArgsSwitch
       return Ret;
     }
     // Create a temporary object with the python value
-    auto* Ret = new CBasicObj<T>{*Ty, O.cast<T>()};
-    H.emplace_back(std::unique_ptr<CObj>{Ret});
-    return Ret;
+    return H.create<CBasicObj<T>>(*Ty, O.cast<T>());
   }
 
   static CObj* case_enum(EnumType const* Ty, ObjsHolder& H, PyObjsHolder& PyH, py::handle O)
@@ -198,45 +237,70 @@ struct ConvertArgsSwitch
     }
 
     auto PteTy = Ty->getPointee();
+    // Function pointers can be given as native functions or python
+    // callables. In the latter case, the closure only lives for the duration
+    // of the call.
+    if (auto* FTy = dyn_cast<FunctionType>(PteTy.getType())) {
+      if (auto* F = O.dyn_cast<CFunction>()) {
+        return H.create<CPointerObj>(*Ty, Data<void*>::emplace_owned(F->dataPtr()));
+      }
+      if (PyCallable_Check(O.ptr())) {
+        return H.create<CClosure>(*FTy, py::reinterpret_borrow<py::object>(O));
+      }
+    }
+
     const bool isWritable = !PteTy.hasConst();
     // If the argument is const char* and we have a py::str, do an automatic conversion using UTF8!
     // TODO: let the user choose if this automatic conversion must happen, and the codec to use!
     if (!isWritable) {
       if (auto* BTy = dyn_cast<BasicType>(PteTy.getType())) {
         if (BTy->getBasicKind() == BasicType::Char) {
-          py::handle Tmp = O;
+          const char* Buffer = nullptr;
           if (PyUnicode_Check(O.ptr())) {
+#if PY_MAJOR_VERSION >= 3
+            // The UTF-8 representation is cached by the str object, so it is
+            // only computed (and allocated) on the first call with a given
+            // string, and lives as long as it.
+            Py_ssize_t Size;
+            Buffer = PyUnicode_AsUTF8AndSize(O.ptr(), &Size);
+            if (!Buffer) {
+              PyErr_Clear();
+              throw TypeError{"Unable to extract string contents! (encoding issue)"};
+            }
+#else
             py::object Buf = py::reinterpret_steal<py::object>(PyUnicode_AsUTF8String(O.ptr()));
-            if (!Buf)
+            if (!Buf) {
+              PyErr_Clear();
               throw TypeError{"Unable to extract string contents! (encoding issue)"};
+            }
             // Keep this object for the call lifetime as we will get its
             // underlying buffer!
             PyH.emplace_back(Buf);
-            Tmp = Buf;
+            Buffer = PyBytes_AS_STRING(Buf.ptr());
+#endif
+          }
+          else
+          if (PyBytes_Check(O.ptr())) {
+            Buffer = PyBytes_AS_STRING(O.ptr());
+          }
+          // Other objects (e.g. bytearray) go through the buffer protocol
+          if (Buffer) {
+            return H.create<CPointerObj>(*Ty, Data<void*>::emplace_owned(const_cast<char*>(Buffer)));
           }
-          char *Buffer = PYBIND11_BYTES_AS_STRING(Tmp.ptr());
-          if (!Buffer)
-            throw TypeError{"Unable to extract string contents! (invalid type)"};
-          auto* Ret = new CPointerObj{*Ty, Data<void*>::emplace_owned(Buffer)};
-          H.emplace_back(std::unique_ptr<CObj>{Ret});
-          return Ret;
         }
       }
     }
     // Cast this as a buffer
     py::buffer B = O.cast<py::buffer>();
     py::buffer_info Info = B.request(isWritable);
-    if (Info.ndim != 1) {
-      ThrowError<TypeError>() << "buffer should have only one dimension, got " << Info.ndim << "!";
+    if (!isCContiguous(Info)) {
+      throw TypeError{"buffer isn't contiguous, use FFI.view(buffer, gather=True) to get a contiguous copy!"};
     }
-    auto ExpectedFormat = getFormatDescriptor(PteTy);
-    if (Info.format != ExpectedFormat) {
-      ThrowError<TypeError>() << "buffer doesn't have the good format, got '" << Info.format << "', expected '" << ExpectedFormat << "'";
+    if (!bufferMatchesPointee(Info, PteTy)) {
+      ThrowError<TypeError>() << "buffer doesn't have the good format, got '" << Info.format << "', expected '" << getFormatDescriptor(PteTy) << "'";
     }
 
-    auto* Ret = new CPointerObj{*Ty, Data<void*>::emplace_owned(Info.ptr)};
-    H.emplace_back(std::unique_ptr<CObj>{Ret});
-    return Ret;
+    return H.create<CPointerObj>(*Ty, Data<void*>::emplace_owned(Info.ptr));
   }
 
   static CObj* case_composite(StructType const* Ty, ObjsHolder&, PyObjsHolder&, py::handle O)
@@ -254,6 +318,32 @@ struct ConvertArgsSwitch
     return checkType(O.cast<CArrayObj*>(), Ty);
   }
 
+  static CObj* case_vector(VectorType const* Ty, ObjsHolder& H, PyObjsHolder&, py::handle O)
+  {
+    if (auto* VObj = O.dyn_cast<CVectorObj>()) {
+      return checkType(VObj, Ty);
+    }
+    // Lanes can be given as a buffer or a sequence of python values
+    std::unique_ptr<CVectorObj> Ret{new CVectorObj{*Ty}};
+    if (PyObject_CheckBuffer(O.ptr())) {
+      py::buffer_info Info = O.cast<py::buffer>().request();
+      if (Info.ndim != 1 || !formatMatches(Info, Ty->getElementType()) || (size_t)Info.size != Ty->getNumElements()) {
+        ThrowError<TypeError>() << "buffer doesn't match the vector type, expected " << Ty->getNumElements() << " elements of format '" << getFormatDescriptor(Ty->getElementType()) << "'";
+      }
+      memcpy(Ret->getData(), Info.ptr, Info.size*Info.itemsize);
+    }
+    else {
+      py::sequence Seq = O.cast<py::sequence>();
+      if (Seq.size() != Ty->getNumElements()) {
+        ThrowError<TypeError>() << "expected " << Ty->getNumElements() << " vector lanes, got " << Seq.size();
+      }
+      for (size_t I = 0; I < Seq.size(); ++I) {
+        Ret->set(I, Seq[I]);
+      }
+    }
+    return H.add(std::move(Ret));
+  }
+
   static CObj* case_func(FunctionType const* Ty, ObjsHolder&, PyObjsHolder&, py::handle O)
   {
     return checkType(O.cast<CFunction*>(), Ty);
@@ -296,6 +386,11 @@ struct CreateObjSwitch
     return std::unique_ptr<CObj>{new CArrayObj{*Ty}};
   }
 
+  static std::unique_ptr<CObj> case_vector(VectorType const* Ty)
+  {
+    return std::unique_ptr<CObj>{new CVectorObj{*Ty}};
+  }
+
   static std::unique_ptr<CObj> case_func(FunctionType const* Ty)
   {
     return std::unique_ptr<CObj>{new CFunction{Ty->getFunction(nullptr)}};
@@ -303,32 +398,600 @@ struct CreateObjSwitch
 };
 using CreateObj = TypeDispatcher<CreateObjSwitch>;
 
+// Typed conversions of python ints and floats, without going through the
+// pybind11 casters. They return false (resp. nullptr) if the object (resp.
+// the type) isn't handled, in which case the generic conversion is used.
+// char is left to the generic path, which converts it from/to a str.
+template <class T, class Enable = void>
+struct FastValue
+{
+  static bool from(PyObject*, T&) { return false; }
+  static PyObject* to(T) { return nullptr; }
+};
+
+template <class T>
+struct FastValue<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) <= sizeof(long long) && !std::is_same<T, char>::value>::type>
+{
+  using LimitTy = typename std::conditional<std::is_signed<T>::value, long long, unsigned long long>::type;
+
+  static bool from(PyObject* O, T& Out)
+  {
+    if (!PyLong_CheckExact(O)) {
+      return false;
+    }
+    const LimitTy V = std::is_signed<T>::value ? (LimitTy)PyLong_AsLongLong(O) : (LimitTy)PyLong_AsUnsignedLongLong(O);
+    if (V == (LimitTy)-1 && PyErr_Occurred()) {
+      // Let the generic conversion report the error
+      PyErr_Clear();
+      return false;
+    }
+    if (V < std::numeric_limits<T>::min() || V > std::numeric_limits<T>::max()) {
+      return false;
+    }
+    Out = static_cast<T>(V);
+    return true;
+  }
+
+  static PyObject* to(T V)
+  {
+    return std::is_signed<T>::value ? PyLong_FromLongLong(V) : PyLong_FromUnsignedLongLong(V);
+  }
+};
+
+template <class T>
+struct FastValue<T, typename std::enable_if<std::is_same<T, float>::value || std::is_same<T, double>::value>::type>
+{
+  static bool from(PyObject* O, T& Out)
+  {
+    if (!PyFloat_CheckExact(O)) {
+      return false;
+    }
+    Out = static_cast<T>(PyFloat_AS_DOUBLE(O));
+    return true;
+  }
+
+  static PyObject* to(T V)
+  {
+    return PyFloat_FromDouble(V);
+  }
+};
+
+// Sets N values of type Ty, separated by Stride bytes, from an array of
+// python objects. Null objects are skipped. The type is dispatched once for
+// all the values.
+struct BulkSetter
+{
+  static void generic(Type const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    for (size_t I = 0; I < N; ++I) {
+      if (Items[I]) {
+        TypeDispatcher<ValueSetter>::switch_(Ty, static_cast<char*>(Data) + I*Stride, py::handle{Items[I]});
+      }
+    }
+  }
+
+  template <class T>
+  static void case_basic(BasicType const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    for (size_t I = 0; I < N; ++I) {
+      if (!Items[I]) {
+        continue;
+      }
+      T* Out = reinterpret_cast<T*>(static_cast<char*>(Data) + I*Stride);
+      if (!FastValue<T>::from(Items[I], *Out)) {
+        *Out = py::handle{Items[I]}.cast<T>();
+      }
+    }
+  }
+
+  static void case_enum(EnumType const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    case_basic<EnumType::IntType>(Ty->getBasicType(), Data, Stride, N, Items);
+  }
+
+  template <class T>
+  static void case_composite(T const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    generic(Ty, Data, Stride, N, Items);
+  }
+
+  static void case_pointer(PointerType const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    generic(Ty, Data, Stride, N, Items);
+  }
+
+  static void case_array(ArrayType const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    generic(Ty, Data, Stride, N, Items);
+  }
+
+  static void case_vector(VectorType const* Ty, void* Data, size_t Stride, size_t N, PyObject** Items)
+  {
+    generic(Ty, Data, Stride, N, Items);
+  }
+
+  static void case_func(FunctionType const* Ty, void*, size_t, size_t, PyObject**)
+  {
+    throw TypeError{"unable to set a value to a function!"};
+  }
+};
+
+// Returns a list of the N contiguous values of type Ty at Data
+struct BulkGetter
+{
+  static py::list generic(Type const* Ty, void* Data, size_t N)
+  {
+    py::list Ret(N);
+    for (size_t I = 0; I < N; ++I) {
+      py::object V = TypeDispatcher<ValueGetter>::switch_(Ty, static_cast<char*>(Data) + I*Ty->getSize());
+      PyList_SET_ITEM(Ret.ptr(), I, V.release().ptr());
+    }
+    return Ret;
+  }
+
+  template <class T>
+  static py::list case_basic(BasicType const* Ty, void* Data, size_t N)
+  {
+    T const* Values = reinterpret_cast<T const*>(Data);
+    py::list Ret(N);
+    for (size_t I = 0; I < N; ++I) {
+      PyObject* V = FastValue<T>::to(Values[I]);
+      if (!V) {
+        if (PyErr_Occurred()) {
+          throw py::error_already_set{};
+        }
+        V = py::cast(Values[I]).release().ptr();
+      }
+      PyList_SET_ITEM(Ret.ptr(), I, V);
+    }
+    return Ret;
+  }
+
+  static py::list case_enum(EnumType const* Ty, void* Data, size_t N)
+  {
+    return case_basic<EnumType::IntType>(Ty->getBasicType(), Data, N);
+  }
+
+  template <class T>
+  static py::list case_composite(T const* Ty, void* Data, size_t N)
+  {
+    return generic(Ty, Data, N);
+  }
+
+  static py::list case_pointer(PointerType const* Ty, void* Data, size_t N)
+  {
+    return generic(Ty, Data, N);
+  }
+
+  static py::list case_array(ArrayType const* Ty, void* Data, size_t N)
+  {
+    return generic(Ty, Data, N);
+  }
+
+  static py::list case_vector(VectorType const* Ty, void* Data, size_t N)
+  {
+    return generic(Ty, Data, N);
+  }
+
+  static py::list case_func(FunctionType const*, void*, size_t)
+  {
+    throw TypeError{"unable to get the value of a function!"};
+  }
+};
+
+// Returns a sequence whose items can be accessed with
+// PySequence_Fast_ITEMS. Lists and tuples aren't copied.
+py::object getFastSequence(py::handle Obj)
+{
+  auto Ret = py::reinterpret_steal<py::object>(PySequence_Fast(Obj.ptr(), "expected an iterable object"));
+  if (!Ret) {
+    throw py::error_already_set{};
+  }
+  return Ret;
+}
+
 } // anonymous
 
-std::string getFormatDescriptor(Type const* Ty)
+namespace {
+
+void appendFormat(std::string& Out, Type const* Ty);
+
+std::string basicFormat(BasicType const* Ty)
 {
-  if (auto* BTy = dffi::dyn_cast<BasicType>(Ty)) {
 #define HANDLE_BASICTY(DTy, CTy)\
-    case BasicType::DTy:\
-      return py::format_descriptor<CTy>::format();
+  case BasicType::DTy:\
+    return py::format_descriptor<CTy>::format();
 
-    switch (BTy->getBasicKind()) {
-      HANDLE_BASICTY(Char, char);
-      HANDLE_BASICTY(UInt8, uint8_t);
-      HANDLE_BASICTY(UInt16, uint16_t);
-      HANDLE_BASICTY(UInt32, uint32_t);
-      HANDLE_BASICTY(UInt64, uint64_t);
-      HANDLE_BASICTY(Int8, int8_t);
-      HANDLE_BASICTY(Int16, int16_t);
-      HANDLE_BASICTY(Int32, int32_t);
-      HANDLE_BASICTY(Int64, int64_t);
-      HANDLE_BASICTY(Float32, float);
-      HANDLE_BASICTY(Float64, double);
-      default:
+  switch (Ty->getBasicKind()) {
+    HANDLE_BASICTY(Char, char);
+    HANDLE_BASICTY(UInt8, uint8_t);
+    HANDLE_BASICTY(UInt16, uint16_t);
+    HANDLE_BASICTY(UInt32, uint32_t);
+    HANDLE_BASICTY(UInt64, uint64_t);
+    HANDLE_BASICTY(Int8, int8_t);
+    HANDLE_BASICTY(Int16, int16_t);
+    HANDLE_BASICTY(Int32, int32_t);
+    HANDLE_BASICTY(Int64, int64_t);
+    HANDLE_BASICTY(Float32, float);
+    HANDLE_BASICTY(Float64, double);
+    case BasicType::Float128:
+      return "g";
+    case BasicType::ComplexFloat32:
+      return "Zf";
+    case BasicType::ComplexFloat64:
+      return "Zd";
+    case BasicType::ComplexFloat128:
+      return "Zg";
+    default:
       break;
+  };
+#undef HANDLE_BASICTY
+  // 128-bit integers have no PEP 3118 code, expose them as raw bytes
+  return "(" + std::to_string(Ty->getSize()) + ")B";
+}
+
+void appendCompositeFormat(std::string& Out, CompositeType const* Ty)
+{
+  // PEP 3118 has no notion of unions, so they are exposed as raw bytes.
+  if (dffi::isa<UnionType>(Ty) || Ty->isOpaque()) {
+    Out += "(" + std::to_string(Ty->getSize()) + ")B";
+    return;
+  }
+  Out += "T{";
+  uint64_t Off = 0;
+  for (auto const& F: Ty->getFields()) {
+    if (F.getOffset() > Off) {
+      Out += std::to_string(F.getOffset() - Off) + "x";
+    }
+    appendFormat(Out, F.getType());
+    if (*F.getName()) {
+      Out += ":";
+      Out += F.getName();
+      Out += ":";
+    }
+    Off = F.getOffset() + F.getType()->getSize();
+  }
+  if (Ty->getSize() > Off) {
+    Out += std::to_string(Ty->getSize() - Off) + "x";
+  }
+  Out += "}";
+}
+
+void appendFormat(std::string& Out, Type const* Ty)
+{
+  switch (Ty->getKind()) {
+    case Type::TY_Basic:
+      Out += basicFormat(dffi::cast<BasicType>(Ty));
+      return;
+    case Type::TY_Pointer:
+      Out += py::format_descriptor<uintptr_t>::format();
+      return;
+    case Type::TY_Enum:
+      Out += py::format_descriptor<EnumType::IntType>::format();
+      return;
+    case Type::TY_Struct:
+    case Type::TY_Union:
+      appendCompositeFormat(Out, dffi::cast<CompositeType>(Ty));
+      return;
+    case Type::TY_Array:
+    {
+      // Multi-dimensional arrays are flattened into one shape
+      std::string Shape;
+      while (auto* ATy = dffi::dyn_cast<dffi::ArrayType>(Ty)) {
+        Shape += (Shape.empty() ? "(" : ",") + std::to_string(ATy->getNumElements());
+        Ty = ATy->getElementType();
+      }
+      Out += Shape + ")";
+      appendFormat(Out, Ty);
+      return;
+    }
+    case Type::TY_Vector:
+    {
+      auto* VTy = dffi::cast<VectorType>(Ty);
+      Out += "(" + std::to_string(VTy->getNumElements()) + ")";
+      appendFormat(Out, VTy->getElementType());
+      return;
+    }
+    default:
+      Out += "(" + std::to_string(Ty->getSize()) + ")B";
+      return;
+  };
+}
+
+// Flattened layout of a PEP 3118 format string: the offset, kind and size of
+// every scalar it describes. Padding bytes are not recorded, so that two
+// formats describing the same memory layout compare equal even if they don't
+// use the same type codes or the same way of expressing alignment.
+struct FormatItem
+{
+  size_t Offset;
+  char Kind; // 'i': signed, 'u': unsigned, 'f': float, 'c': complex, '?': bool, 's': char
+  size_t Size;
+
+  bool operator==(FormatItem const& O) const
+  {
+    return Offset == O.Offset && Kind == O.Kind && Size == O.Size;
+  }
+};
+using FormatLayout = std::vector<FormatItem>;
+
+class FormatParser
+{
+public:
+  FormatParser(std::string const& Fmt):
+    Cur_(Fmt.c_str()),
+    End_(Fmt.c_str() + Fmt.size())
+  { }
+
+  bool parse(FormatLayout& Out, size_t& Size)
+  {
+    size_t Align;
+    return parseItems(Out, Size, Align, false) && Cur_ == End_;
+  }
+
+private:
+  static size_t alignTo(size_t V, size_t Align)
+  {
+    return (V + Align - 1) / Align * Align;
+  }
+
+  bool parseInt(size_t& V)
+  {
+    if (Cur_ == End_ || !isdigit(*Cur_)) {
+      return false;
+    }
+    V = 0;
+    while (Cur_ != End_ && isdigit(*Cur_)) {
+      V = V*10 + (*Cur_ - '0');
+      ++Cur_;
+    }
+    return true;
+  }
+
+  bool parseScalar(char C, char& Kind, size_t& Size)
+  {
+    switch (C) {
+#define HANDLE_CODE(Code, K, NativeSize, StdSize)\
+      case Code:\
+        Kind = K;\
+        Size = Std_ ? StdSize : NativeSize;\
+        return true;
+      HANDLE_CODE('c', 's', 1, 1)
+      HANDLE_CODE('b', 'i', 1, 1)
+      HANDLE_CODE('B', 'u', 1, 1)
+      HANDLE_CODE('?', '?', sizeof(bool), 1)
+      HANDLE_CODE('h', 'i', sizeof(short), 2)
+      HANDLE_CODE('H', 'u', sizeof(short), 2)
+      HANDLE_CODE('i', 'i', sizeof(int), 4)
+      HANDLE_CODE('I', 'u', sizeof(int), 4)
+      HANDLE_CODE('l', 'i', sizeof(long), 4)
+      HANDLE_CODE('L', 'u', sizeof(long), 4)
+      HANDLE_CODE('q', 'i', sizeof(long long), 8)
+      HANDLE_CODE('Q', 'u', sizeof(long long), 8)
+      HANDLE_CODE('n', 'i', sizeof(ssize_t), sizeof(ssize_t))
+      HANDLE_CODE('N', 'u', sizeof(size_t), sizeof(size_t))
+      HANDLE_CODE('P', 'u', sizeof(void*), sizeof(void*))
+      HANDLE_CODE('e', 'f', 2, 2)
+      HANDLE_CODE('f', 'f', sizeof(float), 4)
+      HANDLE_CODE('d', 'f', sizeof(double), 8)
+      HANDLE_CODE('g', 'f', sizeof(long double), sizeof(long double))
+#undef HANDLE_CODE
+      default:
+        return false;
     };
   }
-  return std::to_string(Ty->getSize()) + "B";
+
+  // Parses a sequence of items, up to the end of the string or, if Nested is
+  // true, up to the closing brace of the current T{} block.
+  bool parseItems(FormatLayout& Out, size_t& Size, size_t& Align, bool Nested)
+  {
+    size_t Off = 0;
+    Align = 1;
+    while (true) {
+      if (Cur_ == End_) {
+        if (Nested) {
+          return false;
+        }
+        break;
+      }
+      char C = *Cur_;
+      if (isspace(C)) {
+        ++Cur_;
+        continue;
+      }
+      if (C == '}') {
+        if (!Nested) {
+          return false;
+        }
+        ++Cur_;
+        break;
+      }
+      switch (C) {
+        case '@': Aligned_ = true;  Std_ = false; ++Cur_; continue;
+        case '^': Aligned_ = false; Std_ = false; ++Cur_; continue;
+        case '=':
+        case '<': Aligned_ = false; Std_ = true;  ++Cur_; continue;
+        // Byte swapping isn't supported
+        case '>':
+        case '!': return false;
+        default: break;
+      };
+
+      size_t Count = 1;
+      if (C == '(') {
+        ++Cur_;
+        while (true) {
+          size_t Dim;
+          if (!parseInt(Dim)) {
+            return false;
+          }
+          Count *= Dim;
+          if (Cur_ == End_) {
+            return false;
+          }
+          C = *Cur_++;
+          if (C == ')') {
+            break;
+          }
+          if (C != ',') {
+            return false;
+          }
+        }
+      }
+      else
+      if (isdigit(C)) {
+        parseInt(Count);
+      }
+      if (Cur_ == End_) {
+        return false;
+      }
+
+      C = *Cur_++;
+      FormatLayout Sub;
+      size_t ItemSize;
+      size_t ItemAlign;
+      if (C == 'x') {
+        Off += Count;
+        continue;
+      }
+      if (C == 'T') {
+        if (Cur_ == End_ || *Cur_ != '{') {
+          return false;
+        }
+        ++Cur_;
+        if (!parseItems(Sub, ItemSize, ItemAlign, true)) {
+          return false;
+        }
+      }
+      else {
+        char Kind;
+        if (C == 's' || C == 'p') {
+          // Count is the length of the string here
+          Kind = 's';
+          ItemSize = 1;
+        }
+        else
+        if (C == 'Z') {
+          if (Cur_ == End_ || !parseScalar(*Cur_++, Kind, ItemSize) || Kind != 'f') {
+            return false;
+          }
+          Kind = 'c';
+          ItemSize *= 2;
+        }
+        else
+        if (!parseScalar(C, Kind, ItemSize)) {
+          return false;
+        }
+        ItemAlign = C == 'Z' ? ItemSize/2 : ItemSize;
+        Sub.push_back(FormatItem{0, Kind, ItemSize});
+      }
+
+      if (Aligned_) {
+        Off = alignTo(Off, ItemAlign);
+      }
+      for (size_t I = 0; I < Count; ++I) {
+        for (auto const& It: Sub) {
+          Out.push_back(FormatItem{Off + I*ItemSize + It.Offset, It.Kind, It.Size});
+        }
+      }
+      Off += Count*ItemSize;
+      Align = std::max(Align, ItemAlign);
+
+      // Optional field name
+      if (Cur_ != End_ && *Cur_ == ':') {
+        Cur_ = std::find(Cur_+1, End_, ':');
+        if (Cur_ == End_) {
+          return false;
+        }
+        ++Cur_;
+      }
+    }
+    Size = Off;
+    return true;
+  }
+
+  const char* Cur_;
+  const char* End_;
+  bool Aligned_ = true;
+  bool Std_ = false;
+};
+
+bool parseFormat(std::string const& Fmt, FormatLayout& Out, size_t& Size)
+{
+  return FormatParser{Fmt}.parse(Out, Size);
+}
+
+} // anonymous
+
+std::string getFormatDescriptor(Type const* Ty)
+{
+  if (auto* BTy = dffi::dyn_cast<BasicType>(Ty)) {
+    return basicFormat(BTy);
+  }
+  // The '^' prefix disables native alignment: padding is explicit in the
+  // generated format.
+  std::string Ret = dffi::isa<StructType>(Ty) ? "^" : "";
+  appendFormat(Ret, Ty);
+  return Ret;
+}
+
+bool formatMatches(py::buffer_info const& Info, Type const* Ty)
+{
+  const auto Expected = getFormatDescriptor(Ty);
+  if (Info.format == Expected) {
+    return true;
+  }
+  if (static_cast<uint64_t>(Info.itemsize) != Ty->getSize()) {
+    return false;
+  }
+  FormatLayout BufLayout;
+  FormatLayout TyLayout;
+  size_t BufSize;
+  size_t TySize;
+  if (!parseFormat(Info.format, BufLayout, BufSize) || !parseFormat(Expected, TyLayout, TySize)) {
+    return false;
+  }
+  return BufSize <= static_cast<size_t>(Info.itemsize) && BufLayout == TyLayout;
+}
+
+bool isCContiguous(py::buffer_info const& Info)
+{
+  ssize_t Stride = Info.itemsize;
+  for (ssize_t I = Info.ndim-1; I >= 0; --I) {
+    // The stride of a dimension of size 1 doesn't matter
+    if (Info.shape[I] > 1 && Info.strides[I] != Stride) {
+      return false;
+    }
+    Stride *= Info.shape[I];
+  }
+  return true;
+}
+
+static void gatherDim(py::buffer_info const& Info, ssize_t Dim, const char* Src, char*& Out)
+{
+  const ssize_t N = Info.shape[Dim];
+  const ssize_t Stride = Info.strides[Dim];
+  if (Dim < Info.ndim-1) {
+    for (ssize_t I = 0; I < N; ++I) {
+      gatherDim(Info, Dim+1, Src + I*Stride, Out);
+    }
+    return;
+  }
+  if (Stride == Info.itemsize) {
+    memcpy(Out, Src, N*Info.itemsize);
+    Out += N*Info.itemsize;
+    return;
+  }
+  for (ssize_t I = 0; I < N; ++I) {
+    memcpy(Out, Src + I*Stride, Info.itemsize);
+    Out += Info.itemsize;
+  }
+}
+
+void gatherStrided(py::buffer_info const& Info, void* Dst)
+{
+  char* Out = static_cast<char*>(Dst);
+  gatherDim(Info, 0, static_cast<const char*>(Info.ptr), Out);
 }
 
 py::object CArrayObj::get(size_t Idx) {
@@ -339,6 +1002,90 @@ void CArrayObj::set(size_t Idx, py::handle Obj) {
   TypeDispatcher<ValueSetter>::switch_(getElementType(), GEP(Idx), Obj);
 }
 
+void CArrayObj::fromIterable(py::handle Obj)
+{
+  py::object Seq = getFastSequence(Obj);
+  const size_t N = PySequence_Fast_GET_SIZE(Seq.ptr());
+  if (N != getType()->getNumElements()) {
+    ThrowError<TypeError>() << "expected " << getType()->getNumElements() << " elements, got " << N;
+  }
+  auto* EltTy = getElementType();
+  TypeDispatcher<BulkSetter>::switch_(EltTy, getData(), EltTy->getSize(), N, PySequence_Fast_ITEMS(Seq.ptr()));
+}
+
+py::list CArrayObj::toList()
+{
+  return TypeDispatcher<BulkGetter>::switch_(getElementType(), getData(), getType()->getNumElements());
+}
+
+void CArrayObj::fromRecords(py::handle Records)
+{
+  auto* STy = dffi::dyn_cast<StructType>(getElementType());
+  if (!STy || STy->isOpaque()) {
+    throw TypeError{"records can only be set to arrays of defined structures!"};
+  }
+  py::object Seq = getFastSequence(Records);
+  const size_t N = PySequence_Fast_GET_SIZE(Seq.ptr());
+  if (N != getType()->getNumElements()) {
+    ThrowError<TypeError>() << "expected " << getType()->getNumElements() << " records, got " << N;
+  }
+  PyObject** Recs = PySequence_Fast_ITEMS(Seq.ptr());
+  auto const& Fields = STy->getFields();
+
+  // Check the structure of all the records first
+  for (size_t I = 0; I < N; ++I) {
+    PyObject* R = Recs[I];
+    if (PyDict_Check(R)) {
+      for (auto It: py::reinterpret_borrow<py::dict>(R)) {
+        const auto Name = It.first.cast<std::string>();
+        if (!STy->getField(Name.c_str())) {
+          ThrowError<UnknownField>() << "unknown field " << Name;
+        }
+      }
+    }
+    else
+    if (PyTuple_Check(R) || PyList_Check(R)) {
+      if ((size_t)PySequence_Fast_GET_SIZE(R) != Fields.size()) {
+        ThrowError<TypeError>() << "record " << I << " has " << PySequence_Fast_GET_SIZE(R) << " values, expected " << Fields.size();
+      }
+    }
+    else {
+      throw TypeError{"records must be dicts, tuples or lists!"};
+    }
+  }
+
+  if (N == 0) {
+    return;
+  }
+
+  // Records are set one field at a time, so that the field type is only
+  // dispatched once. Fields missing from dict records are left untouched.
+  // Values are converted into a copy of the array, so that it is left
+  // unmodified if one of them can't be converted.
+  const size_t Size = getSize();
+  auto Scratch = Data<void>::allocate(Size, getAlign(), false);
+  char* Buf = static_cast<char*>(Scratch.dataPtr());
+  memcpy(Buf, getData(), Size);
+  std::vector<PyObject*> Items(N);
+  for (size_t FI = 0; FI < Fields.size(); ++FI) {
+    auto const& F = Fields[FI];
+    for (size_t I = 0; I < N; ++I) {
+      PyObject* R = Recs[I];
+      Items[I] = PyDict_Check(R) ? PyDict_GetItemString(R, F.getName()) : PySequence_Fast_GET_ITEM(R, FI);
+    }
+    TypeDispatcher<BulkSetter>::switch_(F.getType(), Buf + F.getOffset(), STy->getSize(), N, &Items[0]);
+  }
+  memcpy(getData(), Buf, Size);
+}
+
+py::object CVectorObj::get(size_t Idx) {
+  return TypeDispatcher<ValueGetter>::switch_(getElementType(), GEP(Idx));
+}
+
+void CVectorObj::set(size_t Idx, py::handle Obj) {
+  TypeDispatcher<ValueSetter>::switch_(getElementType(), GEP(Idx), Obj);
+}
+
 void CCompositeObj::setValue(CompositeField const& Field, py::handle Obj)
 {
   void* Ptr = getFieldData(Field);
@@ -351,6 +1098,95 @@ py::object CCompositeObj::getValue(CompositeField const& Field)
   return TypeDispatcher<ValueGetter>::switch_(Field.getType(), Ptr);
 }
 
+namespace {
+
+// This map is never destroyed, as python objects can't be released after the
+// interpreter finalization.
+std::unordered_map<CompositeType const*, py::object>& getCompositeClasses()
+{
+  static auto* Classes = new std::unordered_map<CompositeType const*, py::object>{};
+  return *Classes;
+}
+
+void compositeSetAttr(py::handle Self, py::str Name, py::handle Value)
+{
+  if (PyObject_GenericSetAttr(Self.ptr(), Name.ptr(), Value.ptr()) == 0) {
+    return;
+  }
+  if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+    PyErr_Clear();
+    ThrowError<UnknownField>() << "unknown field " << std::string{Name};
+  }
+  throw py::error_already_set{};
+}
+
+} // anonymous
+
+py::handle getCompositeClass(CompositeType const* Ty)
+{
+  auto& Classes = getCompositeClasses();
+  auto It = Classes.find(Ty);
+  if (It != Classes.end()) {
+    return It->second;
+  }
+
+  const bool IsStruct = isa<StructType>(Ty);
+  py::handle Base = py::detail::get_type_handle(IsStruct ? typeid(CStructObj) : typeid(CUnionObj), true);
+  // Classes are named after their C types, and anonymous ones are numbered
+  static size_t AnonIdx = 0;
+  std::string Name = Ty->getName();
+  if (Name.empty()) {
+    Name = (IsStruct ? "struct_" : "union_") + std::to_string(AnonIdx++);
+  }
+  py::dict Dict;
+  Dict["__slots__"] = py::tuple{};
+  Dict["__module__"] = Base.attr("__module__");
+  py::object Cls = py::reinterpret_borrow<py::object>((PyObject*)Py_TYPE(Base.ptr()))(py::str{Name}, py::make_tuple(Base), Dict);
+  Cls.attr("__setattr__") = py::cpp_function{compositeSetAttr, py::is_method(Cls)};
+
+  py::object Property = py::module::import("builtins").attr("property");
+  for (CompositeField const& F: Ty->getFields()) {
+    // Methods of CObj objects aren't hidden by fields
+    if (py::hasattr(Base, F.getName())) {
+      continue;
+    }
+    CompositeField const* FPtr = &F;
+    py::cpp_function Get{[FPtr](CCompositeObj& O) { return O.getValue(*FPtr); }};
+    py::cpp_function Set{[FPtr](CCompositeObj& O, py::handle V) { O.setValue(*FPtr, V); }};
+    Cls.attr(F.getName()) = Property(Get, Set);
+  }
+  return Classes.emplace(Ty, std::move(Cls)).first->second;
+}
+
+void releaseCompositeClasses(details::DFFIImpl const& Dffi)
+{
+  auto& Classes = getCompositeClasses();
+  for (auto It = Classes.begin(); It != Classes.end(); ) {
+    if (&It->first->getDFFI() == &Dffi) {
+      It = Classes.erase(It);
+    }
+    else {
+      ++It;
+    }
+  }
+}
+
+py::object toPyObject(std::unique_ptr<CObj> O)
+{
+  if (!O) {
+    return py::none();
+  }
+  auto* CTy = dyn_cast<CompositeType>(O->getType());
+  py::object Ret = py::cast(O.release(), py::return_value_policy::take_ownership);
+  if (CTy) {
+    static PyObject* ClassAttr = PyUnicode_InternFromString("__class__");
+    if (PyObject_GenericSetAttr(Ret.ptr(), ClassAttr, getCompositeClass(CTy).ptr()) != 0) {
+      throw py::error_already_set{};
+    }
+  }
+  return Ret;
+}
+
 std::unique_ptr<CObj> CPointerObj::getObj() {
   return TypeDispatcher<PtrToObjView>::switch_(getPointeeType(), getPtr());
 }
@@ -361,7 +1197,7 @@ py::memoryview CPointerObj::getMemoryView(size_t Len)
   const size_t PointeeSize = PointeeTy->getSize();
   // TODO: check integer overflow
   // TODO: ssize_t is an issue
-  return py::memoryview{py::buffer_info{getPtr(), static_cast<ssize_t>(PointeeSize), getFormatDescriptor(PointeeTy), static_cast<ssize_t>(PointeeSize*Len)}};
+  return py::memoryview{py::buffer_info{getPtr(), static_cast<ssize_t>(PointeeSize), getFormatDescriptor(PointeeTy), static_cast<ssize_t>(Len)}};
 }
 
 py::memoryview CPointerObj::getMemoryViewCStr()
@@ -375,17 +1211,140 @@ py::memoryview CPointerObj::getMemoryViewCStr()
   return getMemoryView(Len);
 }
 
+CFunction::CFunction(NativeFunc const& NF):
+  CObj(*NF.getType()),
+  NF_(NF),
+  TypedReturns_(true),
+  ScalarRet_(false),
+  PyScalarRet_(false),
+  RetCacheObj_(nullptr),
+  InCall_(false)
+{
+  auto* RetTy = getType()->getReturnType();
+  if (!RetTy) {
+    return;
+  }
+  if (auto* BTy = dyn_cast<BasicType>(RetTy)) {
+    ScalarRet_ = true;
+    switch (BTy->getBasicKind()) {
+      case BasicType::Int128:
+      case BasicType::UInt128:
+      case BasicType::ComplexFloat32:
+      case BasicType::ComplexFloat64:
+      case BasicType::ComplexFloat128:
+        // No native python counterpart
+        break;
+      default:
+        PyScalarRet_ = true;
+        break;
+    };
+  }
+  else
+  if (isa<EnumType>(RetTy)) {
+    ScalarRet_ = true;
+    PyScalarRet_ = true;
+  }
+  else
+  if (isa<PointerType>(RetTy)) {
+    ScalarRet_ = true;
+  }
+}
+
+template <class Invoke>
+py::object CFunction::invoke(Invoke const& Call) const
+{
+  auto* RetTy = getType()->getReturnType();
+  if (ScalarRet_) {
+    if (!TypedReturns_ && PyScalarRet_) {
+      // The trampoline writes the returned value on the stack, and it is
+      // directly converted to a python object.
+      alignas(16) uint8_t RetBuf[32];
+      assert(RetTy->getSize() <= sizeof(RetBuf) && "scalar type too big!");
+      Call(&RetBuf[0]);
+      return TypeDispatcher<ValueGetter>::switch_(RetTy, &RetBuf[0]);
+    }
+
+    // If the previously returned object isn't referenced anymore, reuse it.
+    // Otherwise, allocate a new one that will be cached in its turn. While a
+    // call is in flight, reentrant calls (from a python callback) get fresh
+    // objects, as the cached one is going to be written by the outer call.
+    if (!InCall_) {
+      if (!RetCacheObj_ || RetCache_.ref_count() != 1) {
+        RetCacheObj_ = CreateObj::switch_(RetTy).release();
+        RetCache_ = py::cast(RetCacheObj_, py::return_value_policy::take_ownership);
+      }
+      // Keeps the cached object alive even if a callback releases this
+      // function.
+      py::object Ret = RetCache_;
+      InCall_ = true;
+      try {
+        Call(RetCacheObj_->dataPtr());
+      }
+      catch (...) {
+        InCall_ = false;
+        throw;
+      }
+      InCall_ = false;
+      return Ret;
+    }
+  }
+
+  std::unique_ptr<CObj> RetObj;
+  if (RetTy) {
+    RetObj = CreateObj::switch_(RetTy);
+  }
+  Call(RetTy ? RetObj->dataPtr() : nullptr);
+  if (RetObj) {
+    return toPyObject(std::move(RetObj));
+  }
+  return py::none();
+}
+
+// Returns the type of a python object given as the variadic argument Idx of
+// FTy. C objects keep their types, and python ones get the types C gives to
+// the equivalent literals.
+static QualType getVarArgType(FunctionType const* FTy, size_t Idx, py::handle O)
+{
+  if (auto* Obj = O.dyn_cast<CObj>()) {
+    return Obj->getType();
+  }
+  if (PyLong_Check(O.ptr())) {
+    int Overflow = 0;
+    const long long V = PyLong_AsLongLongAndOverflow(O.ptr(), &Overflow);
+    if (Overflow > 0) {
+      return BasicType::get(FTy, BasicType::getKind<unsigned long long>());
+    }
+    if (Overflow == 0 && V >= INT_MIN && V <= INT_MAX) {
+      return BasicType::get(FTy, BasicType::getKind<int>());
+    }
+    return BasicType::get(FTy, BasicType::getKind<long long>());
+  }
+  if (PyFloat_Check(O.ptr())) {
+    return BasicType::get(FTy, BasicType::getKind<double>());
+  }
+  if (PyUnicode_Check(O.ptr()) || PyBytes_Check(O.ptr())) {
+    return PointerType::get(QualType{BasicType::get(FTy, BasicType::Char), QualType::Const});
+  }
+  ThrowError<TypeError>() << "unable to deduce the type of variadic argument " << Idx << ": use a C object";
+  return {nullptr};
+}
+
 py::object CFunction::call(py::args const& Args) const
 {
-  ConvertArgsSwitch::ObjsHolder Holders;
-  ConvertArgsSwitch::PyObjsHolder PyHolders;
+  FunctionType const* FTy = getType();
+  if (FTy->hasVarArgs()) {
+    return callVarArgs(Args);
+  }
 
+  ObjsHolder Holders{&CallArena::get()};
+  ConvertArgsSwitch::PyObjsHolder PyHolders;
   std::vector<void*> Ptrs;
   const auto Len = py::len(Args);
   Ptrs.reserve(Len);
 
-  FunctionType const* FTy = getType();
-  assert(Len == FTy->getParams().size());
+  if (Len != FTy->getParams().size()) {
+    ThrowError<TypeError>() << "expected " << FTy->getParams().size() << " arguments, got " << Len;
+  }
 
   size_t I = 0;
   for (auto& A: Args) {
@@ -395,16 +1354,208 @@ py::object CFunction::call(py::args const& Args) const
     ++I;
   }
 
+  return invoke([&](void* Ret) { NF_.call(Ret, Ptrs.data()); });
+}
+
+py::object CFunction::callVarArgs(py::args const& Args) const
+{
+  ObjsHolder Holders{&CallArena::get()};
+  ConvertArgsSwitch::PyObjsHolder PyHolders;
+
+  FunctionType const* FTy = getType();
+  const size_t NFixed = FTy->getNumFixedParams();
+  const size_t Len = py::len(Args);
+  if (Len < NFixed) {
+    ThrowError<TypeError>() << "expected at least " << NFixed << " arguments, got " << Len;
+  }
+
+  // Each call shape gets its own function type, whose trampoline is cached by
+  // dffi.
+  std::vector<QualType> VarArgsTys;
+  VarArgsTys.reserve(Len-NFixed);
+  for (size_t I = NFixed; I < Len; ++I) {
+    VarArgsTys.push_back(getVarArgType(FTy, I, Args[I]));
+  }
+  const auto NF = NF_.getVarArgsFunction(VarArgsTys);
+  auto const& Params = NF.getType()->getParams();
+
+  std::vector<void*> Ptrs;
+  Ptrs.reserve(Len);
+  for (size_t I = 0; I < Len; ++I) {
+    py::handle A = Args[I];
+    CObj* AObj = nullptr;
+    CObj* Obj = I >= NFixed ? A.dyn_cast<CObj>() : nullptr;
+    if (Obj && isa<BasicType>(Obj->getType()) && Obj->getType() != Params[I].getType()) {
+      // Promoted C scalars
+      AObj = Holders.add(Obj->cast(Params[I]));
+    }
+    else {
+      AObj = ConvertArgs::switch_(Params[I], Holders, PyHolders, A);
+    }
+    Ptrs.push_back(AObj->dataPtr());
+  }
+
+  return invoke([&](void* Ret) { NF.call(Ret, Ptrs.data()); });
+}
+
+py::object CFunction::callFrame(void* Frame) const
+{
+  return invoke([&](void* Ret) { NF_.callFrame(Ret, Frame); });
+}
+
+CFunction CFunction::specialize(py::kwargs const& KW) const
+{
+  // Pointers to the converted objects (closures, temporary arrays, ...) can
+  // be compiled in the specialized function, which thus owns them. They are
+  // allocated on the heap, as they outlive this call.
+  auto Holders = std::make_shared<ObjsHolder>();
+  ConvertArgsSwitch::PyObjsHolder PyHolders;
+
+  FunctionType const* FTy = getType();
+  auto const& Params = FTy->getParams();
+  std::map<unsigned, void const*> Args;
+  for (auto const& It: KW) {
+    const std::string Name = It.first.cast<std::string>();
+    char* End = nullptr;
+    unsigned long Idx = 0;
+    if (Name.compare(0, 3, "arg") == 0 && Name.size() > 3) {
+      Idx = strtoul(Name.c_str()+3, &End, 10);
+    }
+    if (End == nullptr || *End != 0) {
+      ThrowError<TypeError>() << "invalid argument name '" << Name << "', expected 'argN'";
+    }
+    if (Idx >= Params.size()) {
+      ThrowError<TypeError>() << "argument index " << Idx << " is out of range";
+    }
+    auto* AObj = ConvertArgs::switch_(Params[Idx], *Holders, PyHolders, It.second);
+    Args[Idx] = AObj->dataPtr();
+  }
+
+  std::string Err;
+  auto NF = NF_.specialize(Args, Err);
+  if (!NF) {
+    throw CompileError{std::move(Err)};
+  }
+  CFunction Ret{NF};
+  Ret.TypedReturns_ = TypedReturns_;
+  Ret.BoundObjs_ = BoundObjs_;
+  Ret.BoundHolders_ = BoundHolders_;
+  Ret.BoundHolders_.emplace_back(std::move(Holders));
+  for (auto const& It: KW) {
+    Ret.BoundObjs_.emplace_back(py::reinterpret_borrow<py::object>(It.second));
+  }
+  for (auto& O: PyHolders) {
+    Ret.BoundObjs_.emplace_back(std::move(O));
+  }
+  return Ret;
+}
+
+CArgsFrame::CArgsFrame(CFunction const& F):
+  F_(F),
+  Frame_(F.getNativeFunc().newFrame()),
+  Holders_(Frame_.getNumArgs())
+{ }
+
+void CArgsFrame::set(size_t Idx, py::handle O)
+{
+  if (Idx >= size()) {
+    ThrowError<TypeError>() << "argument index " << Idx << " is out of range";
+  }
+  // Objects converted for the previous value of this argument are released
+  // only once the new one has been set, so that converting an argument to
+  // itself works.
+  ArgHolder H;
+  auto* AObj = ConvertArgs::switch_(F_.getType()->getParams()[Idx], H.Objs, H.PyObjs, O);
+  Frame_.set(Idx, AObj->dataPtr());
+  H.PyObjs.emplace_back(py::reinterpret_borrow<py::object>(O));
+  Holders_[Idx] = std::move(H);
+}
+
+py::object CArgsFrame::get(size_t Idx) const
+{
+  if (Idx >= size()) {
+    ThrowError<TypeError>() << "argument index " << Idx << " is out of range";
+  }
+  return TypeDispatcher<ValueGetter>::switch_(F_.getType()->getParams()[Idx], Frame_.getArgPtr(Idx));
+}
+
+CCursor::CCursor(Type const* Ty, void* Ptr, size_t N):
+  Ty_(Ty),
+  Ptr_(reinterpret_cast<uint8_t*>(Ptr)),
+  Stride_(Ty->getSize()),
+  N_(N),
+  Idx_(0),
+  Scalar_(isa<BasicType>(Ty) || isa<EnumType>(Ty)),
+  ViewObj_(nullptr)
+{ }
+
+py::object CCursor::next()
+{
+  if (Idx_ >= N_) {
+    throw py::stop_iteration{};
+  }
+  void* Ptr = Ptr_ + Idx_*Stride_;
+  ++Idx_;
+  if (Scalar_) {
+    return TypeDispatcher<ValueGetter>::switch_(Ty_, Ptr);
+  }
+  if (!ViewObj_) {
+    auto Obj = TypeDispatcher<PtrToObjView>::switch_(Ty_, Ptr);
+    ViewObj_ = Obj.get();
+    View_ = toPyObject(std::move(Obj));
+  }
+  else {
+    ViewObj_->setView(Ptr);
+  }
+  return View_;
+}
+
+CClosure::CClosure(FunctionType const& FTy, py::object Callable):
+  CPointerObj(*PointerType::get(&FTy)),
+  Callable_(std::move(Callable))
+{
+  if (FTy.hasVarArgs()) {
+    throw TypeError{"unable to create a closure for a variadic function!"};
+  }
+  NC_ = FTy.getClosure(&CClosure::handler, this);
+  *reinterpret_cast<void**>(dataPtr()) = NC_.getCodePtr();
+}
+
+void CClosure::handler(void* Ctx, void* Ret, void** Args)
+{
+  // This can be called from any thread
+  py::gil_scoped_acquire Gil;
+
+  auto* Self = static_cast<CClosure*>(Ctx);
+  FunctionType const* FTy = Self->getFuncType();
   auto* RetTy = FTy->getReturnType();
-  std::unique_ptr<CObj> RetObj;
-  if (RetTy) {
-    RetObj = CreateObj::switch_(RetTy);
+  auto const& Params = FTy->getParams();
+  try {
+    py::tuple PyArgs(Params.size());
+    for (size_t I = 0; I < Params.size(); ++I) {
+      PyArgs[I] = TypeDispatcher<ValueGetter>::switch_(Params[I], Args[I]);
+    }
+    py::object PyRet = Self->Callable_(*PyArgs);
+    if (RetTy) {
+      TypeDispatcher<ValueSetter>::switch_(RetTy, Ret, PyRet);
+    }
+    return;
   }
-  NF_.call(RetTy ? RetObj->dataPtr() : nullptr, &Ptrs[0]);
-  if (RetObj) {
-    return py::cast(RetObj.release(), py::return_value_policy::take_ownership);
+  catch (py::error_already_set& E) {
+    E.restore();
+  }
+  catch (DFFIError const& E) {
+    PyErr_SetString(PyExc_TypeError, E.what());
+  }
+  catch (std::exception const& E) {
+    PyErr_SetString(PyExc_RuntimeError, E.what());
+  }
+  // Exceptions can't be propagated through C code. Report it, and return a
+  // zero-initialized value.
+  PyErr_WriteUnraisable(Self->Callable_.ptr());
+  if (RetTy) {
+    memset(Ret, 0, RetTy->getSize());
   }
-  return py::none();
 }
 
 // Cast
@@ -439,6 +1590,21 @@ std::unique_ptr<CObj> CArrayObj::cast(Type const* To) const
   return std::unique_ptr<CObj>{Ret};
 }
 
+std::unique_ptr<CObj> CVectorObj::cast(Type const* To) const
+{
+  CObj* Ret = nullptr;
+  if (auto* VTy = dyn_cast<VectorType>(To)) {
+    if (VTy->getSize() == getType()->getSize()) {
+      Ret = new CVectorObj{*VTy, Data<void>::view((void*)getData())};
+    }
+  }
+  else
+  if (auto* PTy = dyn_cast<PointerType>(To)) {
+    Ret = new CPointerObj{*PTy, Data<void*>::emplace_owned((void*)getData())};
+  }
+  return std::unique_ptr<CObj>{Ret};
+}
+
 std::unique_ptr<CObj> CCompositeObj::cast(Type const* To) const
 {
   CObj* Ret = nullptr;
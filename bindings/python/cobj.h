@@ -23,6 +23,8 @@
 #include <dffi/composite_type.h>
 #include <dffi/casting.h>
 
+#include "alloc.h"
+#include "arena.h"
 #include "errors.h"
 
 // Python C types 
@@ -134,16 +136,22 @@ struct Data<void>
   enum Type: uint8_t {
     OwnedFree = 1,
     View = 2,
+    // Allocated with allocData
+    OwnedAlloc = 3,
   };
 
 
   Data():
     Ptr_(nullptr),
-    Ty_(View)
+    Size_(0),
+    Ty_(View),
+    AKind_(AllocKind::Malloc)
   { }
 
   Data(Data&& O):
-    Ty_(O.Ty_)
+    Size_(O.Size_),
+    Ty_(O.Ty_),
+    AKind_(O.AKind_)
   {
     Ptr_ = O.release();
   }
@@ -154,7 +162,9 @@ struct Data<void>
   {
     if (&O != this) {
       clear();
+      Size_ = O.Size_;
       Ty_ = O.Ty_;
+      AKind_ = O.AKind_;
       Ptr_ = O.release();
     }
     return *this;
@@ -177,6 +187,24 @@ struct Data<void>
     return {Ptr, OwnedFree};
   }
 
+  // Allocates Size bytes following the allocation policy (see AllocPolicy)
+  static Data allocate(size_t Size, size_t Align, bool Initialize = true, AllocPolicy::InitKind DefaultInit = AllocPolicy::Pattern)
+  {
+    Data Ret{nullptr, OwnedAlloc};
+    Ret.Ptr_ = allocData(Size, Align, Initialize, DefaultInit, Ret.AKind_);
+    Ret.Size_ = Size;
+    return Ret;
+  }
+
+  // Takes the ownership of a file mapping of Size bytes starting at Ptr
+  static Data mapped(void* Ptr, size_t Size)
+  {
+    Data Ret{Ptr, OwnedAlloc};
+    Ret.Size_ = Size;
+    Ret.AKind_ = AllocKind::Mmap;
+    return Ret;
+  }
+
   ~Data()
   {
     clear();
@@ -188,6 +216,9 @@ struct Data<void>
       case OwnedFree:
         free(Ptr_);
         break;
+      case OwnedAlloc:
+        releaseData(Ptr_, Size_, AKind_);
+        break;
       case View:
         break;
     }
@@ -199,11 +230,15 @@ struct Data<void>
 private:
   Data(void* Ptr, Type Ty):
     Ptr_(Ptr),
-    Ty_(Ty)
+    Size_(0),
+    Ty_(Ty),
+    AKind_(AllocKind::Malloc)
   { }
 
   void* Ptr_;
+  size_t Size_;
   Type Ty_;
+  AllocKind AKind_;
 };
 
 struct CObj
@@ -219,6 +254,13 @@ struct CObj
 
   virtual std::unique_ptr<CObj> cast(dffi::Type const* To) const = 0;
 
+  // Makes this object a view of the value at Ptr (see CCursor). Only
+  // pointers, arrays, vectors, structures and unions can be moved.
+  virtual void setView(void* Ptr)
+  {
+    throw TypeError{"this object can't be moved to another value!"};
+  }
+
   inline size_t getSize() const { return getType()->getSize(); }
   inline size_t getAlign() const { return getType()->getAlign(); }
 
@@ -226,6 +268,93 @@ private:
   dffi::Type const* Ty_;
 };
 
+// Temporary objects created by the conversion of arguments. Those of a call
+// are placement-constructed in the thread-local CallArena, and destroyed with
+// the holder. Without an arena (e.g. for argument frames, which outlive
+// calls), they are allocated on the heap.
+class ObjsHolder
+{
+public:
+  explicit ObjsHolder(CallArena* Arena = nullptr):
+    Arena_(Arena),
+    Mark_(Arena ? Arena->mark() : CallArena::Mark{0, 0}),
+    Last_(nullptr)
+  { }
+
+  ObjsHolder(ObjsHolder&& O):
+    Arena_(O.Arena_),
+    Mark_(O.Mark_),
+    Last_(O.Last_),
+    Heap_(std::move(O.Heap_))
+  {
+    O.Arena_ = nullptr;
+    O.Last_ = nullptr;
+  }
+
+  ObjsHolder& operator=(ObjsHolder&& O)
+  {
+    if (&O != this) {
+      clear();
+      Arena_ = O.Arena_;
+      Mark_ = O.Mark_;
+      Last_ = O.Last_;
+      Heap_ = std::move(O.Heap_);
+      O.Arena_ = nullptr;
+      O.Last_ = nullptr;
+    }
+    return *this;
+  }
+
+  ObjsHolder(ObjsHolder const&) = delete;
+  ObjsHolder& operator=(ObjsHolder const&) = delete;
+
+  ~ObjsHolder() { clear(); }
+
+  template <class T, class... Args>
+  T* create(Args&& ... args)
+  {
+    if (!Arena_) {
+      T* Ret = new T{std::forward<Args>(args)...};
+      Heap_.emplace_back(Ret);
+      return Ret;
+    }
+    T* Ret = new (Arena_->allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    Last_ = new (Arena_->allocate(sizeof(Node), alignof(Node))) Node{Ret, Last_};
+    return Ret;
+  }
+
+  CObj* add(std::unique_ptr<CObj> O)
+  {
+    Heap_.emplace_back(std::move(O));
+    return Heap_.back().get();
+  }
+
+private:
+  struct Node
+  {
+    CObj* Obj;
+    Node* Prev;
+  };
+
+  void clear()
+  {
+    for (Node* N = Last_; N != nullptr; N = N->Prev) {
+      N->Obj->~CObj();
+    }
+    Last_ = nullptr;
+    if (Arena_) {
+      Arena_->release(Mark_);
+      Arena_ = nullptr;
+    }
+    Heap_.clear();
+  }
+
+  CallArena* Arena_;
+  CallArena::Mark Mark_;
+  Node* Last_;
+  std::vector<std::unique_ptr<CObj>> Heap_;
+};
+
 template <class T>
 struct CBasicObj: public CObj
 {
@@ -354,6 +483,8 @@ struct CPointerObj: public CObj
 
   std::unique_ptr<CObj> cast(dffi::Type const* To) const override;
 
+  void setView(void* Ptr) override { Data_ = Data<void*>::view((void**)Ptr); }
+
   pybind11::memoryview getMemoryView(size_t Len);
   pybind11::memoryview getMemoryViewCStr();
 
@@ -362,6 +493,19 @@ private:
   Data<void*> Data_;
 };
 
+// const char* pointer to the UTF-8 encoding of a Python string, which is
+// kept alive by this object (see FFI.cstr).
+struct CStrObj: public CPointerObj
+{
+  CStrObj(dffi::PointerType const& Ty, pybind11::bytes Str):
+    CPointerObj(Ty, Data<void*>::emplace_owned(PyBytes_AS_STRING(Str.ptr()))),
+    Str_(std::move(Str))
+  { }
+
+private:
+  pybind11::bytes Str_;
+};
+
 struct CArrayObj: public CObj
 {
   CArrayObj(dffi::ArrayType const& Ty, Data<void>&& D):
@@ -369,18 +513,12 @@ struct CArrayObj: public CObj
     Data_(std::move(D))
   { }
 
-  CArrayObj(dffi::ArrayType const& Ty):
-    CObj(Ty)
-  {
-    void* Ptr;
-    size_t Align = std::max(sizeof(void*), (size_t)Ty.getAlign());
-    auto Size = Ty.getSize();
-    if (posix_memalign(&Ptr, Align, Size) != 0) {
-      throw AllocError{"allocation failure!"};
-    }
-    memset(Ptr, 0xDD, Size);
-    Data_ = Data<void>::owned_free(Ptr);
-  }
+  // If Initialize is false, the data is left uninitialized whatever the
+  // allocation policy is, as the caller will fill it.
+  CArrayObj(dffi::ArrayType const& Ty, bool Initialize = true):
+    CObj(Ty),
+    Data_(Data<void>::allocate(Ty.getSize(), Ty.getAlign(), Initialize))
+  { }
 
   void* dataPtr() override { return getData(); }
   void* getData() { return Data_.dataPtr(); }
@@ -402,8 +540,60 @@ struct CArrayObj: public CObj
   pybind11::object get(size_t Idx);
   void set(size_t Idx, pybind11::handle Obj);
 
+  // Bulk conversions, with the element type only dispatched once. Lists and
+  // tuples of python ints and floats are converted without going through
+  // pybind11 casters.
+  void fromIterable(pybind11::handle Obj);
+  pybind11::list toList();
+  // Sets an array of structures from a sequence of dicts (indexed by field
+  // names) or tuples (of all the fields, in order). The array is left
+  // unmodified if any record or value is invalid.
+  void fromRecords(pybind11::handle Records);
+
   std::unique_ptr<CObj> cast(dffi::Type const* To) const override;
 
+  void setView(void* Ptr) override { Data_ = Data<void>::view(Ptr); }
+
+private:
+  Data<void> Data_;
+};
+
+struct CVectorObj: public CObj
+{
+  CVectorObj(dffi::VectorType const& Ty, Data<void>&& D):
+    CObj(Ty),
+    Data_(std::move(D))
+  { }
+
+  // Vectors are zero-initialized by default
+  CVectorObj(dffi::VectorType const& Ty):
+    CObj(Ty),
+    Data_(Data<void>::allocate(Ty.getSize(), Ty.getAlign(), true, AllocPolicy::Zero))
+  { }
+
+  void* dataPtr() override { return getData(); }
+  void* getData() { return Data_.dataPtr(); }
+  void const* getData() const { return Data_.dataPtr(); }
+
+  inline dffi::VectorType const* getType() const { return dffi::cast<dffi::VectorType>(CObj::getType()); }
+
+  dffi::BasicType const* getElementType() const { return getType()->getElementType(); }
+  size_t size() const { return getType()->getNumElements(); }
+
+  void* GEP(size_t Idx) {
+    if (Idx >= size()) {
+      ThrowError<TypeError>() << "lane index " << Idx << " is out of range";
+    }
+    return reinterpret_cast<uint8_t*>(getData()) + (Idx*getElementType()->getSize());
+  }
+
+  pybind11::object get(size_t Idx);
+  void set(size_t Idx, pybind11::handle Obj);
+
+  std::unique_ptr<CObj> cast(dffi::Type const* To) const override;
+
+  void setView(void* Ptr) override { Data_ = Data<void>::view(Ptr); }
+
 private:
   Data<void> Data_;
 };
@@ -419,12 +609,7 @@ struct CCompositeObj: public CObj
     CObj(Ty)
   {
     assert(!Ty.isOpaque() && "can't instantiate an opaque structure/union!");
-    void* Ptr;
-    size_t Align = std::max(sizeof(void*), (size_t)Ty.getAlign());
-    if (posix_memalign(&Ptr, Align, getSize()) != 0) {
-      throw AllocError{"allocation failure!"};
-    }
-    Data_ = Data<void>::owned_free(Ptr);
+    Data_ = Data<void>::allocate(getSize(), Ty.getAlign(), true, AllocPolicy::Uninitialized);
   }
 
   void setZero()
@@ -462,6 +647,8 @@ struct CCompositeObj: public CObj
 
   std::unique_ptr<CObj> cast(dffi::Type const* To) const override;
 
+  void setView(void* Ptr) override { Data_ = Data<void>::view(Ptr); }
+
 private:
   void* getFieldData(dffi::CompositeField const& F)
   {
@@ -498,14 +685,25 @@ struct CUnionObj: public CCompositeObj
   { }
 };
 
+// Returns the python class of the objects of the structure or union Ty. It
+// is generated on first use, as a subclass of CStructObj or CUnionObj with a
+// property for each field, whose offset and type are thus resolved once
+// (instead of at each access by __getattr__/__setattr__).
+pybind11::handle getCompositeClass(dffi::CompositeType const* Ty);
+
+// Releases the classes generated for the composite types of Dffi, before it
+// is destroyed.
+void releaseCompositeClasses(dffi::details::DFFIImpl const& Dffi);
+
+// Returns a python object owning O (or None if O is null). Structures and
+// unions get the class generated for their type.
+pybind11::object toPyObject(std::unique_ptr<CObj> O);
+
 struct CFunction: public CObj
 {
   using TrampPtrTy = dffi::NativeFunc::TrampPtrTy;
 
-  CFunction(dffi::NativeFunc const& NF):
-    CObj(*NF.getType()),
-    NF_(NF)
-  { }
+  CFunction(dffi::NativeFunc const& NF);
 
   pybind11::object call(pybind11::args const& Args) const;
 
@@ -515,12 +713,137 @@ struct CFunction: public CObj
 
   std::unique_ptr<CObj> cast(dffi::Type const* To) const override { return {nullptr}; }
 
+  // If false, scalar values (integers, floats and enums) are returned as
+  // native python objects instead of CBasicObj ones. Typed returns are the
+  // default, so that existing code using the returned objects keeps working.
+  bool hasTypedReturns() const { return TypedReturns_; }
+  void setTypedReturns(bool V) { TypedReturns_ = V; }
+
+  // Returns a new function with the arguments given as argN=value keywords
+  // bound to constants. The python objects giving these values are kept
+  // alive by the returned function.
+  CFunction specialize(pybind11::kwargs const& KW) const;
+
+  // Calls the function with its arguments packed in Frame (see
+  // dffi::NativeFunc::callFrame).
+  pybind11::object callFrame(void* Frame) const;
+
+  dffi::NativeFunc const& getNativeFunc() const { return NF_; }
+
+  // Keeps the objects bound to F (see specialize) alive as long as this
+  // function, for functions whose code calls F.
+  void keepBoundAlive(CFunction const& F)
+  {
+    BoundObjs_.insert(BoundObjs_.end(), F.BoundObjs_.begin(), F.BoundObjs_.end());
+    BoundHolders_.insert(BoundHolders_.end(), F.BoundHolders_.begin(), F.BoundHolders_.end());
+  }
+
 private:
+  // Calls a variadic function, with the types of the variadic arguments
+  // deduced from the python objects.
+  pybind11::object callVarArgs(pybind11::args const& Args) const;
+
+  // Calls Invoke with the pointer where the returned value must be written,
+  // and converts it to a python object.
+  template <class Invoke>
+  pybind11::object invoke(Invoke const& Call) const;
+
   dffi::NativeFunc NF_;
+  std::vector<pybind11::object> BoundObjs_;
+  // C objects converted from the bound values of specialized functions
+  std::vector<std::shared_ptr<ObjsHolder>> BoundHolders_;
+  bool TypedReturns_;
+  bool ScalarRet_;
+  bool PyScalarRet_;
+
+  // Last returned scalar object. It is reused by the next call if python
+  // doesn't hold any other reference to it.
+  mutable pybind11::object RetCache_;
+  mutable CObj* RetCacheObj_;
+  // True while a call writing into the cached object is in flight
+  mutable bool InCall_;
+};
+
+// Packed arguments frame of a CFunction (see dffi::ArgsFrame). Arguments are
+// converted when they are set, and the python objects they may refer to are
+// kept alive by the frame, which can then be used for several calls.
+struct CArgsFrame
+{
+  CArgsFrame(CFunction const& F);
+
+  void set(size_t Idx, pybind11::handle O);
+  pybind11::object get(size_t Idx) const;
+  size_t size() const { return Frame_.getNumArgs(); }
+
+  pybind11::object call() const { return F_.callFrame(Frame_.data()); }
+
+private:
+  struct ArgHolder
+  {
+    ObjsHolder Objs;
+    std::vector<pybind11::object> PyObjs;
+  };
+
+  CFunction const& F_;
+  dffi::ArgsFrame Frame_;
+  std::vector<ArgHolder> Holders_;
+};
+
+// Iterator over N contiguous values of type Ty. Scalars are returned as
+// python values, and other values through a single view object that is
+// moved to the next element at each step (see CObj::setView). This object is
+// thus only valid until the next step, and must be copied to be kept.
+struct CCursor
+{
+  CCursor(dffi::Type const* Ty, void* Ptr, size_t N);
+
+  pybind11::object next();
+  size_t size() const { return N_-Idx_; }
+
+private:
+  dffi::Type const* Ty_;
+  uint8_t* Ptr_;
+  size_t Stride_;
+  size_t N_;
+  size_t Idx_;
+  bool Scalar_;
+
+  pybind11::object View_;
+  CObj* ViewObj_;
+};
+
+// Pointer to a JIT-compiled C function which calls a python callable. The C
+// arguments are given as python objects that are only valid for the duration
+// of the call.
+struct CClosure: public CPointerObj
+{
+  CClosure(dffi::FunctionType const& FTy, pybind11::object Callable);
+  CClosure(CClosure const&) = delete;
+
+  inline dffi::FunctionType const* getFuncType() const { return NC_.getType(); }
+  pybind11::object const& getCallable() const { return Callable_; }
+
+private:
+  static void handler(void* Ctx, void* Ret, void** Args);
+
+  pybind11::object Callable_;
+  dffi::NativeClosure NC_;
 };
 
 std::string getFormatDescriptor(dffi::Type const* Ty);
 
+// Returns whether the layout described by the format of a buffer matches the
+// memory layout of Ty.
+bool formatMatches(pybind11::buffer_info const& Info, dffi::Type const* Ty);
+
+// Whether the elements of a (possibly multi-dimensional) buffer are stored
+// contiguously, in row-major order.
+bool isCContiguous(pybind11::buffer_info const& Info);
+
+// Copies the elements of a strided buffer, in row-major order, to Dst which
+// must be large enough to hold all of them.
+void gatherStrided(pybind11::buffer_info const& Info, void* Dst);
+
 namespace {
 template <class T, bool isConvertibleToPtr>
 struct BasicObjConvertor;
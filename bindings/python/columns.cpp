@@ -0,0 +1,237 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include <dffi/composite_type.h>
+#include <dffi/casting.h>
+
+#include "columns.h"
+#include "errors.h"
+
+namespace py = pybind11;
+using namespace dffi;
+
+namespace {
+
+// Copies between an array of N structures and the column buffers
+using ColumnsFuncTy = void(*)(void*, void* const*, size_t);
+
+struct ColumnsKernels
+{
+  ColumnsFuncTy Gather;
+  ColumnsFuncTy Scatter;
+};
+
+struct DFFIColumns
+{
+  DFFI* D;
+  // Kernels only depend on the layout, so they are indexed by the structure
+  // size and the offsets and sizes of the selected fields.
+  std::unordered_map<std::string, ColumnsKernels> Kernels;
+};
+
+std::unordered_map<details::DFFIImpl const*, DFFIColumns>& getRegistry()
+{
+  // Leaked, as DFFI objects can be destroyed during the interpreter shutdown.
+  static auto* Reg = new std::unordered_map<details::DFFIImpl const*, DFFIColumns>{};
+  return *Reg;
+}
+
+// Kernels are compiled in their own compilation units, but share the JIT
+// symbols namespace.
+size_t KernelIdx = 0;
+
+ColumnsKernels getKernels(CompositeType const* Ty, std::vector<CompositeField const*> const& Fields)
+{
+  auto& Reg = getRegistry();
+  auto ItD = Reg.find(&Ty->getDFFI());
+  if (ItD == Reg.end()) {
+    throw TypeError{"the structure type doesn't belong to a pydffi.FFI object!"};
+  }
+  auto& DC = ItD->second;
+
+  std::stringstream Key;
+  Key << Ty->getSize();
+  for (auto* F: Fields) {
+    Key << "," << F->getOffset() << ":" << F->getType()->getSize();
+  }
+  auto It = DC.Kernels.find(Key.str());
+  if (It != DC.Kernels.end()) {
+    return It->second;
+  }
+
+  // Fields are copied with constant-sized memcpy's, which are lowered to
+  // plain loads and stores of the right width whatever the field type is.
+  const std::string Idx = std::to_string(KernelIdx++);
+  const std::string GatherName = "__dffi_gather_" + Idx;
+  const std::string ScatterName = "__dffi_scatter_" + Idx;
+  std::stringstream Decls;
+  std::stringstream GatherBody;
+  std::stringstream ScatterBody;
+  for (size_t I = 0; I < Fields.size(); ++I) {
+    auto* F = Fields[I];
+    const auto Size = F->getType()->getSize();
+    Decls << "  char* __restrict __c" << I << " = (char*)__cols[" << I << "];\n";
+    GatherBody << "    __builtin_memcpy(__c" << I << " + __i*" << Size << ", __e + " << F->getOffset() << ", " << Size << ");\n";
+    ScatterBody << "    __builtin_memcpy(__e + " << F->getOffset() << ", __c" << I << " + __i*" << Size << ", " << Size << ");\n";
+  }
+  std::stringstream ss;
+  ss << "#include <stddef.h>\n\n";
+  ss << "void " << GatherName << "(void* __arr, void* const* __cols, size_t __n) {\n";
+  ss << "  const char* __restrict __src = (const char*)__arr;\n";
+  ss << Decls.str();
+  ss << "  for (size_t __i = 0; __i < __n; ++__i) {\n";
+  ss << "    const char* __e = __src + __i*" << Ty->getSize() << ";\n";
+  ss << GatherBody.str();
+  ss << "  }\n";
+  ss << "}\n\n";
+  ss << "void " << ScatterName << "(void* __arr, void* const* __cols, size_t __n) {\n";
+  ss << "  char* __restrict __dst = (char*)__arr;\n";
+  ss << Decls.str();
+  ss << "  for (size_t __i = 0; __i < __n; ++__i) {\n";
+  ss << "    char* __e = __dst + __i*" << Ty->getSize() << ";\n";
+  ss << ScatterBody.str();
+  ss << "  }\n";
+  ss << "}\n";
+
+  std::string Err;
+  auto CU = DC.D->compile(ss.str().c_str(), Err);
+  if (!CU) {
+    throw CompileError{std::move(Err)};
+  }
+  auto Gather = CU.getFunction(GatherName.c_str());
+  auto Scatter = CU.getFunction(ScatterName.c_str());
+  assert(Gather && Scatter && "unable to find the compiled kernels!");
+  ColumnsKernels Ret{(ColumnsFuncTy)Gather.getFuncCodePtr(), (ColumnsFuncTy)Scatter.getFuncCodePtr()};
+  DC.Kernels[Key.str()] = Ret;
+  return Ret;
+}
+
+CompositeType const* getCompositeElementType(CArrayObj const& A)
+{
+  auto* CTy = dyn_cast<CompositeType>(A.getElementType());
+  if (!CTy || CTy->isOpaque()) {
+    throw TypeError{"columns can only be extracted from arrays of defined structures or unions!"};
+  }
+  return CTy;
+}
+
+CompositeField const* getField(CompositeType const* Ty, std::string const& Name)
+{
+  auto* F = Ty->getField(Name.c_str());
+  if (!F) {
+    ThrowError<UnknownField>() << "unknown field " << Name;
+  }
+  return F;
+}
+
+} // anonymous
+
+void registerDFFI(DFFI& D)
+{
+  getRegistry()[&D.getCharTy()->getDFFI()] = DFFIColumns{&D, {}};
+}
+
+void unregisterDFFI(DFFI& D)
+{
+  getRegistry().erase(&D.getCharTy()->getDFFI());
+}
+
+py::dict array_columns(py::object Self, py::object Fields)
+{
+  auto& A = Self.cast<CArrayObj&>();
+  auto* CTy = getCompositeElementType(A);
+  std::vector<CompositeField const*> Selected;
+  if (Fields.is_none()) {
+    for (auto const& F: CTy->getFields()) {
+      Selected.push_back(&F);
+    }
+  }
+  else {
+    for (py::handle Name: Fields) {
+      Selected.push_back(getField(CTy, Name.cast<std::string>()));
+    }
+  }
+
+  py::dict Ret;
+  if (Selected.empty()) {
+    return Ret;
+  }
+  auto K = getKernels(CTy, Selected);
+  auto& DC = getRegistry()[&CTy->getDFFI()];
+  const size_t N = A.getType()->getNumElements();
+  std::vector<void*> Ptrs;
+  Ptrs.reserve(Selected.size());
+  for (auto* F: Selected) {
+    auto* Col = new CArrayObj{*DC.D->getArrayType(F->getType(), N), false};
+    Ptrs.push_back(Col->getData());
+    py::object ColObj = py::cast(Col, py::return_value_policy::take_ownership);
+    // Types are owned by the FFI object, which is kept alive by the array
+    py::detail::keep_alive_impl(ColObj, Self);
+    Ret[F->getName()] = ColObj;
+  }
+
+  {
+    py::gil_scoped_release Release;
+    K.Gather(A.getData(), &Ptrs[0], N);
+  }
+  return Ret;
+}
+
+void array_set_columns(CArrayObj& A, py::dict Columns)
+{
+  auto* CTy = getCompositeElementType(A);
+  const size_t N = A.getType()->getNumElements();
+  std::vector<CompositeField const*> Selected;
+  std::vector<py::buffer_info> Bufs;
+  std::vector<void*> Ptrs;
+  Selected.reserve(py::len(Columns));
+  Bufs.reserve(py::len(Columns));
+  Ptrs.reserve(py::len(Columns));
+  for (auto It: Columns) {
+    const auto Name = It.first.cast<std::string>();
+    auto* F = getField(CTy, Name);
+    auto* FTy = F->getType();
+    auto Info = It.second.cast<py::buffer>().request();
+    if (Info.ndim != 1 || Info.strides[0] != Info.itemsize) {
+      ThrowError<TypeError>() << "column " << Name << " should be a contiguous buffer of one dimension!";
+    }
+    if ((size_t)Info.size != N) {
+      ThrowError<TypeError>() << "column " << Name << " has " << Info.size << " elements, expected " << N << "!";
+    }
+    if (!formatMatches(Info, FTy)) {
+      ThrowError<TypeError>() << "column " << Name << " doesn't have the good format, got '" << Info.format << "', expected '" << getFormatDescriptor(FTy) << "'";
+    }
+    // The scatter kernel assumes that the columns and the array don't alias
+    auto* ColBegin = static_cast<uint8_t const*>(Info.ptr);
+    auto* ArrBegin = static_cast<uint8_t const*>(A.getData());
+    if (ColBegin < ArrBegin + A.getSize() && ArrBegin < ColBegin + Info.size*Info.itemsize) {
+      ThrowError<TypeError>() << "column " << Name << " overlaps the array!";
+    }
+    Selected.push_back(F);
+    Ptrs.push_back(Info.ptr);
+    Bufs.emplace_back(std::move(Info));
+  }
+  if (Selected.empty()) {
+    return;
+  }
+
+  auto K = getKernels(CTy, Selected);
+  py::gil_scoped_release Release;
+  K.Scatter(A.getData(), &Ptrs[0], N);
+}
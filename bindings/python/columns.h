@@ -0,0 +1,43 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_COLUMNS_H
+#define PYDFFI_COLUMNS_H
+
+#include <pybind11/pybind11.h>
+
+#include <dffi/dffi.h>
+
+#include "cobj.h"
+
+// Transposition between an array of structures and one contiguous buffer per
+// field ("struct of arrays"). For a given structure layout and set of fields,
+// a gather and a scatter loop are JITed once, with the field offsets and sizes
+// as constants, so that the compiler can vectorize the strided accesses.
+// Kernels are compiled by the DFFI object the structure type belongs to,
+// which thus needs to be registered.
+
+void registerDFFI(dffi::DFFI& D);
+void unregisterDFFI(dffi::DFFI& D);
+
+// Returns a dictionary mapping the names of the selected fields (all of them
+// if Fields is None) to new arrays holding their values.
+pybind11::dict array_columns(pybind11::object Self, pybind11::object Fields);
+
+// Writes back the buffers of Columns (a mapping from field names to buffers
+// of the same length as the array) into the fields of the structures.
+void array_set_columns(CArrayObj& A, pybind11::dict Columns);
+
+#endif
@@ -81,6 +81,10 @@ struct TypeDispatcher
       return T::case_array(ATy, std::forward<Args>(args)...);
     }
     else
+    if (auto* VTy = dffi::dyn_cast<dffi::VectorType>(Ty)) {
+      return T::case_vector(VTy, std::forward<Args>(args)...);
+    }
+    else
     if (auto* FTy = dffi::dyn_cast<dffi::FunctionType>(Ty)) {
       return T::case_func(FTy, std::forward<Args>(args)...);
     }
@@ -0,0 +1,247 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#include "elementwise.h"
+#include "errors.h"
+
+namespace py = pybind11;
+using namespace dffi;
+
+namespace {
+
+// Kernels are compiled in their own compilation units, but share the JIT
+// symbols namespace.
+size_t KernelIdx = 0;
+
+// Minimum number of elements processed by a thread
+constexpr size_t MinChunkSize = 4096;
+
+const char* formatToCType(std::string Format)
+{
+  if (Format.size() == 2 && (Format[0] == '@' || Format[0] == '=')) {
+    Format = Format.substr(1);
+  }
+  if (Format.size() != 1) {
+    ThrowError<TypeError>() << "unsupported buffer format " << Format;
+  }
+  switch (Format[0]) {
+    case 'c': return "char";
+    case 'b': return "signed char";
+    case 'B': return "unsigned char";
+    case '?': return "_Bool";
+    case 'h': return "short";
+    case 'H': return "unsigned short";
+    case 'i': return "int";
+    case 'I': return "unsigned int";
+    case 'l': return "long";
+    case 'L': return "unsigned long";
+    case 'q': return "long long";
+    case 'Q': return "unsigned long long";
+    case 'f': return "float";
+    case 'd': return "double";
+    default:
+      break;
+  };
+  ThrowError<TypeError>() << "unsupported buffer format character " << Format[0];
+  return nullptr;
+}
+
+// Whether the variable Name is assigned by the C statements Expr
+bool isAssigned(std::string const& Expr, std::string const& Name)
+{
+  const std::regex Assign{
+    "(^|[^\\w.>])" + Name + "\\s*(<<|>>|[-+*/%&|^])?=(?!=)|"
+    "(\\+\\+|--)\\s*" + Name + "\\b|"
+    "(^|[^\\w.>])" + Name + "\\s*(\\+\\+|--)"};
+  return std::regex_search(Expr, Assign);
+}
+
+} // anonymous
+
+struct ElementwiseKernel::Var
+{
+  std::string Name;
+  const char* CTy;
+  bool IsBuffer;
+  bool IsOutput;
+  void* Ptr;
+  size_t Size;
+  union {
+    int64_t Int;
+    double Float;
+  } Scalar;
+};
+
+ElementwiseKernel::ElementwiseKernel(DFFI& D, std::string Expr, std::string Preamble, unsigned NThreads):
+  DFFI_(D),
+  Expr_(std::move(Expr)),
+  Preamble_(std::move(Preamble)),
+  NThreads_(NThreads ? NThreads : std::max(std::thread::hardware_concurrency(), 1U))
+{ }
+
+ElementwiseKernel::KernelFuncTy ElementwiseKernel::getKernel(std::vector<Var> const& Vars)
+{
+  std::stringstream Key;
+  for (auto const& V: Vars) {
+    Key << V.Name << (V.IsBuffer ? ":b:" : ":s:") << V.CTy << ",";
+  }
+  auto It = Kernels_.find(Key.str());
+  if (It != Kernels_.end()) {
+    return It->second;
+  }
+
+  // Elements are copied to local variables, so that the statements only
+  // deal with scalar values, and the loop can be vectorized.
+  const std::string Name = "__dffi_elementwise_" + std::to_string(KernelIdx++);
+  std::stringstream ss;
+  ss << "#include <stdint.h>\n";
+  ss << "#include <stddef.h>\n";
+  ss << "#include <math.h>\n";
+  ss << Preamble_ << "\n\n";
+  ss << "void " << Name << "(void* const* __args, size_t __begin, size_t __end) {\n";
+  for (size_t I = 0; I < Vars.size(); ++I) {
+    auto const& V = Vars[I];
+    if (V.IsBuffer) {
+      ss << "  " << V.CTy << "* const __p_" << V.Name << " = (" << V.CTy << "*)__args[" << I << "];\n";
+    }
+    else {
+      ss << "  const " << V.CTy << " " << V.Name << " = *(" << V.CTy << " const*)__args[" << I << "];\n";
+    }
+  }
+  ss << "  for (size_t __i = __begin; __i < __end; ++__i) {\n";
+  for (auto const& V: Vars) {
+    if (V.IsBuffer) {
+      ss << "    " << V.CTy << " " << V.Name << " = __p_" << V.Name << "[__i];\n";
+    }
+  }
+  ss << "    " << Expr_ << ";\n";
+  for (auto const& V: Vars) {
+    if (V.IsOutput) {
+      ss << "    __p_" << V.Name << "[__i] = " << V.Name << ";\n";
+    }
+  }
+  ss << "  }\n";
+  ss << "}\n";
+
+  std::string Err;
+  auto CU = DFFI_.compile(ss.str().c_str(), Err);
+  if (!CU) {
+    throw CompileError{std::move(Err)};
+  }
+  auto NF = CU.getFunction(Name.c_str());
+  assert(NF && "unable to find the compiled kernel!");
+  auto Ret = (KernelFuncTy)NF.getFuncCodePtr();
+  Kernels_[Key.str()] = Ret;
+  return Ret;
+}
+
+void ElementwiseKernel::call(py::kwargs Args)
+{
+  std::vector<Var> Vars;
+  // Keep the buffers alive during the computation
+  std::vector<py::buffer_info> Bufs;
+  Vars.reserve(py::len(Args));
+  Bufs.reserve(py::len(Args));
+  for (auto It: Args) {
+    Var V;
+    V.Name = It.first.cast<std::string>();
+    if (V.Name.compare(0, 2, "__") == 0) {
+      ThrowError<TypeError>() << "invalid variable name " << V.Name;
+    }
+    V.IsOutput = isAssigned(Expr_, V.Name);
+    py::handle O = It.second;
+    if (py::isinstance<py::buffer>(O)) {
+      auto Info = py::reinterpret_borrow<py::buffer>(O).request(V.IsOutput);
+      if (Info.ndim != 1) {
+        ThrowError<TypeError>() << "buffer " << V.Name << " should have only one dimension, got " << Info.ndim << "!";
+      }
+      if (Info.strides[0] != Info.itemsize) {
+        ThrowError<TypeError>() << "buffer " << V.Name << " isn't contiguous!";
+      }
+      V.CTy = formatToCType(Info.format);
+      V.IsBuffer = true;
+      V.Ptr = Info.ptr;
+      V.Size = Info.size;
+      Bufs.emplace_back(std::move(Info));
+    }
+    else {
+      if (V.IsOutput) {
+        ThrowError<TypeError>() << "scalar variable " << V.Name << " can't be assigned!";
+      }
+      if (py::isinstance<py::float_>(O)) {
+        V.CTy = "double";
+        V.Scalar.Float = O.cast<double>();
+      }
+      else
+      if (py::isinstance<py::int_>(O)) {
+        V.CTy = "int64_t";
+        V.Scalar.Int = O.cast<int64_t>();
+      }
+      else {
+        ThrowError<TypeError>() << "variable " << V.Name << " must be a buffer, an int or a float!";
+      }
+      V.IsBuffer = false;
+      V.Size = 0;
+    }
+    Vars.emplace_back(std::move(V));
+  }
+
+  std::sort(Vars.begin(), Vars.end(), [](Var const& A, Var const& B) { return A.Name < B.Name; });
+  size_t N = 0;
+  bool HasBuffer = false;
+  for (auto& V: Vars) {
+    if (!V.IsBuffer) {
+      V.Ptr = &V.Scalar;
+      continue;
+    }
+    if (HasBuffer && V.Size != N) {
+      ThrowError<TypeError>() << "buffer " << V.Name << " has " << V.Size << " elements, expected " << N << "!";
+    }
+    N = V.Size;
+    HasBuffer = true;
+  }
+  if (!HasBuffer) {
+    throw TypeError{"elementwise kernels need at least one buffer!"};
+  }
+
+  auto K = getKernel(Vars);
+  std::vector<void*> Ptrs;
+  Ptrs.reserve(Vars.size());
+  for (auto const& V: Vars) {
+    Ptrs.push_back(V.Ptr);
+  }
+
+  py::gil_scoped_release Release;
+  const size_t NThreads = std::min<size_t>(NThreads_, N/MinChunkSize);
+  if (NThreads <= 1) {
+    K(&Ptrs[0], 0, N);
+    return;
+  }
+  const size_t ChunkSize = (N + NThreads - 1)/NThreads;
+  std::vector<std::thread> Threads;
+  Threads.reserve(NThreads-1);
+  for (size_t Begin = ChunkSize; Begin < N; Begin += ChunkSize) {
+    Threads.emplace_back(K, &Ptrs[0], Begin, std::min(N, Begin+ChunkSize));
+  }
+  K(&Ptrs[0], 0, ChunkSize);
+  for (auto& T: Threads) {
+    T.join();
+  }
+}
@@ -0,0 +1,52 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_ELEMENTWISE_H
+#define PYDFFI_ELEMENTWISE_H
+
+#include <string>
+#include <unordered_map>
+
+#include <pybind11/pybind11.h>
+
+#include <dffi/dffi.h>
+
+// C statements applied to each element of a set of buffers, like
+// "out = a*b + sqrt(c)". Variables are given by keyword when the kernel is
+// called: buffers (of the same length) are seen as their elements, and
+// python ints and floats as int64_t and double constants. Buffers assigned
+// by the statements are written back.
+// A loop is JITed once for each signature (variable names, element and
+// scalar types), and runs over chunks of the buffers in parallel.
+struct ElementwiseKernel
+{
+  using KernelFuncTy = void(*)(void* const*, size_t, size_t);
+
+  ElementwiseKernel(dffi::DFFI& D, std::string Expr, std::string Preamble, unsigned NThreads);
+
+  void call(pybind11::kwargs Args);
+
+private:
+  struct Var;
+  KernelFuncTy getKernel(std::vector<Var> const& Vars);
+
+  dffi::DFFI& DFFI_;
+  std::string Expr_;
+  std::string Preamble_;
+  unsigned NThreads_;
+  std::unordered_map<std::string, KernelFuncTy> Kernels_;
+};
+
+#endif
@@ -0,0 +1,115 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <dffi/dffi.h>
+#include <dffi/casting.h>
+
+#include "errors.h"
+#include "mmap.h"
+
+namespace py = pybind11;
+using namespace dffi;
+
+#ifndef _WIN32
+
+namespace {
+
+[[noreturn]] void throwOSError(const char* Path)
+{
+  PyErr_SetFromErrnoWithFilename(PyExc_OSError, Path);
+  throw py::error_already_set{};
+}
+
+int getAdvice(MmapAdvice Advice)
+{
+  switch (Advice) {
+    case MmapAdvice::Normal:
+      return MADV_NORMAL;
+    case MmapAdvice::Sequential:
+      return MADV_SEQUENTIAL;
+    case MmapAdvice::Random:
+      return MADV_RANDOM;
+    case MmapAdvice::WillNeed:
+      return MADV_WILLNEED;
+  };
+  return MADV_NORMAL;
+}
+
+} // anonymous
+
+std::unique_ptr<CArrayObj> dffi_mmap(DFFI& D, const char* Path, Type const* Ty, size_t Offset, py::object Count, bool Writable, MmapAdvice Advice)
+{
+  if (isa<PointerType>(Ty)) {
+    throw TypeError{"records can't be pointers, use FFI.ptr on the returned array to get a pointer to them!"};
+  }
+  if (Ty->getSize() == 0) {
+    throw TypeError{"records must have a known, non-zero size!"};
+  }
+  if (Offset % Ty->getAlign()) {
+    ThrowError<TypeError>() << "offset " << Offset << " isn't aligned on " << Ty->getAlign() << " bytes!";
+  }
+
+  const int FD = open(Path, Writable ? O_RDWR : O_RDONLY);
+  if (FD < 0) {
+    throwOSError(Path);
+  }
+  struct stat St;
+  if (fstat(FD, &St) != 0) {
+    const int Err = errno;
+    close(FD);
+    errno = Err;
+    throwOSError(Path);
+  }
+  const size_t FileSize = St.st_size;
+  if (Offset >= FileSize) {
+    close(FD);
+    ThrowError<TypeError>() << "offset " << Offset << " is beyond the end of the file (" << FileSize << " bytes)!";
+  }
+  const size_t Avail = FileSize - Offset;
+  const size_t N = Count.is_none() ? Avail / Ty->getSize() : Count.cast<size_t>();
+  if (N == 0 || N > Avail / Ty->getSize()) {
+    close(FD);
+    ThrowError<TypeError>() << "the file doesn't contain " << (N ? N : 1) << " records from offset " << Offset << "!";
+  }
+  const size_t Len = N * Ty->getSize();
+
+  // mmap wants an offset aligned on pages
+  const size_t PageSize = sysconf(_SC_PAGESIZE);
+  const size_t Delta = Offset % PageSize;
+  void* Base = mmap(nullptr, Len + Delta, PROT_READ | PROT_WRITE,
+    Writable ? MAP_SHARED : MAP_PRIVATE, FD, Offset - Delta);
+  const int Err = errno;
+  close(FD);
+  if (Base == MAP_FAILED) {
+    errno = Err;
+    throwOSError(Path);
+  }
+  // This is only a hint
+  madvise(Base, Len + Delta, getAdvice(Advice));
+
+  // The array owns the mapping
+  return std::unique_ptr<CArrayObj>{new CArrayObj{*D.getArrayType(Ty, N),
+    Data<void>::mapped(static_cast<uint8_t*>(Base) + Delta, Len)}};
+}
+
+#endif
@@ -0,0 +1,46 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_MMAP_H
+#define PYDFFI_MMAP_H
+
+#include <memory>
+#include <pybind11/pybind11.h>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+#include "cobj.h"
+
+// Typed views on memory-mapped files. Records are directly accessed in the
+// page cache, without any copy. The mapping is owned by the returned array.
+// This is only available on POSIX systems.
+
+enum class MmapAdvice {
+  Normal,
+  Sequential,
+  Random,
+  WillNeed
+};
+
+#ifndef _WIN32
+// Maps Count records of type Ty from the file at Path, starting at Offset,
+// which must be a multiple of the alignment of Ty. If Count is None, it is
+// deduced from the size of the file. Writable mappings are shared with the
+// file, otherwise modifications are private to the process.
+std::unique_ptr<CArrayObj> dffi_mmap(dffi::DFFI& D, const char* Path, dffi::Type const* Ty, size_t Offset, pybind11::object Count, bool Writable, MmapAdvice Advice);
+#endif
+
+#endif
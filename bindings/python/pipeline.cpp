@@ -0,0 +1,288 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <dffi/composite_type.h>
+#include <dffi/casting.h>
+
+#include "pipeline.h"
+#include "errors.h"
+
+namespace py = pybind11;
+using namespace dffi;
+
+namespace {
+
+// Values are only stored in C variables, so pointers are all printed as void*
+// (the real types are used for the final function type).
+std::string printScalarType(Type const* Ty)
+{
+  if (Ty == nullptr) {
+    return "void";
+  }
+  if (auto* ETy = dyn_cast<EnumType>(Ty)) {
+    Ty = ETy->getBasicType();
+  }
+  if (isa<PointerType>(Ty)) {
+    return "void*";
+  }
+  if (auto* BTy = dyn_cast<BasicType>(Ty)) {
+    switch (BTy->getBasicKind()) {
+      case BasicType::Char:
+        return "char";
+      case BasicType::Int8:
+        return "int8_t";
+      case BasicType::Int16:
+        return "int16_t";
+      case BasicType::Int32:
+        return "int32_t";
+      case BasicType::Int64:
+        return "int64_t";
+      case BasicType::Int128:
+        return "__int128_t";
+      case BasicType::UInt8:
+        return "uint8_t";
+      case BasicType::UInt16:
+        return "uint16_t";
+      case BasicType::UInt32:
+        return "uint32_t";
+      case BasicType::UInt64:
+        return "uint64_t";
+      case BasicType::UInt128:
+        return "__uint128_t";
+      case BasicType::Float32:
+        return "float";
+      case BasicType::Float64:
+        return "double";
+      case BasicType::Float128:
+        return "long double";
+      case BasicType::ComplexFloat32:
+        return "_Complex float";
+      case BasicType::ComplexFloat64:
+        return "_Complex double";
+      case BasicType::ComplexFloat128:
+        return "_Complex long double";
+    };
+  }
+  throw TypeError{"pipelines only support scalar values (basic types, enums and pointers)!"};
+}
+
+// Checks that a value of type From can be given as an argument of type To
+// without any conversion. Pointers can also be given to void* and const
+// qualified parameters.
+bool valueMatches(Type const* From, QualType To)
+{
+  if (From == To.getType()) {
+    return true;
+  }
+  auto* FromPTy = dyn_cast<PointerType>(From);
+  auto* ToPTy = dyn_cast<PointerType>(To.getType());
+  if (!FromPTy || !ToPTy) {
+    return false;
+  }
+  auto FromPointee = FromPTy->getPointee();
+  auto ToPointee = ToPTy->getPointee();
+  if (FromPointee.hasConst() && !ToPointee.hasConst()) {
+    return false;
+  }
+  return ToPointee.getType() == nullptr || ToPointee.getType() == FromPointee.getType();
+}
+
+// Gives a unique name to every pipeline, as they all end up in the same JIT
+size_t PipelineIdx = 0;
+
+} // anonymous
+
+Pipeline::Pipeline(DFFI& D, CFunction& F):
+  DFFI_(D),
+  Name_("__dffi_pipeline_" + std::to_string(PipelineIdx++)),
+  CurTy_(nullptr),
+  NVals_(0),
+  HasNullChecks_(false)
+{
+  callImpl(F, true);
+}
+
+Type const* Pipeline::curType() const
+{
+  if (CurTy_ == nullptr) {
+    throw TypeError{"the current pipeline value is void!"};
+  }
+  return CurTy_;
+}
+
+void Pipeline::callImpl(CFunction& F, bool First)
+{
+  auto* FTy = F.getType();
+  if (FTy->hasVarArgs()) {
+    throw TypeError{"variadic functions can't be used in pipelines!"};
+  }
+  auto const& FParams = FTy->getParams();
+  if (!First && FParams.empty()) {
+    throw TypeError{"function must have at least one parameter to be used in a pipeline!"};
+  }
+
+  std::stringstream FPtrTy;
+  FPtrTy << printScalarType(FTy->getReturnType()) << " (" << CCToClangAttribute(FTy->getCC()) << " *)(";
+  std::stringstream Args;
+  for (size_t I = 0; I < FParams.size(); ++I) {
+    if (I > 0) {
+      FPtrTy << ",";
+      Args << ",";
+    }
+    FPtrTy << printScalarType(FParams[I]);
+    if (I == 0 && !First) {
+      if (!valueMatches(curType(), FParams[0])) {
+        throw TypeError{"the current pipeline value doesn't match the type of the first parameter of the function!"};
+      }
+      Args << "__v" << NVals_-1;
+    }
+    else {
+      Args << "__a" << Params_.size();
+      Params_.push_back(FParams[I]);
+    }
+  }
+  if (FParams.empty()) {
+    FPtrTy << "void";
+  }
+  FPtrTy << ")";
+
+  auto* RetTy = FTy->getReturnType();
+  Body_ << "  ";
+  if (RetTy) {
+    Body_ << printScalarType(RetTy) << " __v" << NVals_++ << " = ";
+  }
+  Body_ << "((" << FPtrTy.str() << ")";
+  if (auto* Slot = F.getNativeFunc().getCodeSlot()) {
+    Body_ << "__atomic_load_n((void**)0x" << std::hex << (uintptr_t)Slot << std::dec << "ULL, __ATOMIC_ACQUIRE)";
+  }
+  else {
+    Body_ << "0x" << std::hex << (uintptr_t)F.dataPtr() << std::dec << "ULL";
+  }
+  Body_ << ")(" << Args.str() << ");\n";
+  CurTy_ = RetTy;
+  Funcs_.push_back(F);
+}
+
+Pipeline& Pipeline::call(CFunction& F)
+{
+  callImpl(F, false);
+  return *this;
+}
+
+Pipeline& Pipeline::field(const char* Name)
+{
+  auto* PTy = dyn_cast<PointerType>(curType());
+  auto* CTy = PTy ? dyn_cast<CompositeType>(PTy->getPointee().getType()) : nullptr;
+  if (!CTy) {
+    throw TypeError{"field extraction needs a pointer to a structure or union!"};
+  }
+  auto* F = CTy->getField(Name);
+  if (!F) {
+    ThrowError<UnknownField>() << "unknown field " << Name;
+  }
+
+  std::stringstream Addr;
+  Addr << "((char*)__v" << NVals_-1 << " + " << F->getOffset() << ")";
+  Type const* FTy = F->getType();
+  Type const* NewTy;
+  Body_ << "  ";
+  if (auto* ATy = dyn_cast<ArrayType>(FTy)) {
+    NewTy = PointerType::get(ATy->getElementType());
+    Body_ << "void* __v" << NVals_ << " = " << Addr.str() << ";\n";
+  }
+  else
+  if (isa<CompositeType>(FTy)) {
+    NewTy = PointerType::get(FTy);
+    Body_ << "void* __v" << NVals_ << " = " << Addr.str() << ";\n";
+  }
+  else {
+    NewTy = FTy;
+    const std::string TyStr = printScalarType(FTy);
+    Body_ << TyStr << " __v" << NVals_ << " = *(" << TyStr << "*)" << Addr.str() << ";\n";
+  }
+  ++NVals_;
+  CurTy_ = NewTy;
+  return *this;
+}
+
+Pipeline& Pipeline::returnIfNull()
+{
+  auto* Ty = curType();
+  if (!isa<PointerType>(Ty)) {
+    throw TypeError{"only pointers can be checked for null values!"};
+  }
+  Body_ << "  if (!__v" << NVals_-1 << ") goto __dffi_null;\n";
+  HasNullChecks_ = true;
+  return *this;
+}
+
+std::string Pipeline::code() const
+{
+  const std::string RetTy = printScalarType(CurTy_);
+  std::stringstream ss;
+  ss << "#include <stdint.h>\n\n";
+  ss << RetTy << " " << Name_ << "(";
+  for (size_t I = 0; I < Params_.size(); ++I) {
+    if (I > 0) {
+      ss << ",";
+    }
+    ss << printScalarType(Params_[I]) << " __a" << I;
+  }
+  if (Params_.empty()) {
+    ss << "void";
+  }
+  ss << ") {\n";
+  ss << Body_.str();
+  if (CurTy_) {
+    ss << "  return __v" << NVals_-1 << ";\n";
+  }
+  else {
+    ss << "  return;\n";
+  }
+  if (HasNullChecks_) {
+    ss << "__dffi_null:\n";
+    if (CurTy_) {
+      ss << "  {\n";
+      ss << "    " << RetTy << " __dffi_zero;\n";
+      ss << "    __builtin_memset(&__dffi_zero, 0, sizeof(__dffi_zero));\n";
+      ss << "    return __dffi_zero;\n";
+      ss << "  }\n";
+    }
+    else {
+      ss << "  return;\n";
+    }
+  }
+  ss << "}\n";
+  return ss.str();
+}
+
+CFunction Pipeline::build()
+{
+  std::string Err;
+  auto CU = DFFI_.compile(code().c_str(), Err);
+  if (!CU) {
+    throw CompileError{std::move(Err)};
+  }
+  auto NF = CU.getFunction(Name_.c_str());
+  assert(NF && "unable to find the compiled pipeline!");
+  // Use the original types, so that returned pointers keep their pointee
+  // types.
+  auto* FTy = DFFI_.getFunctionType(CurTy_, Params_);
+  CFunction Ret{DFFI_.getFunction(FTy, NF.getFuncCodePtr())};
+  for (auto const& F: Funcs_) {
+    Ret.keepBoundAlive(F);
+  }
+  return Ret;
+}
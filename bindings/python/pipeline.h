@@ -0,0 +1,64 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PYDFFI_PIPELINE_H
+#define PYDFFI_PIPELINE_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+#include "cobj.h"
+
+// Sequence of native function calls and field extractions, compiled as a
+// single C function. Each step consumes the value produced by the previous
+// one, so that a multi-step C protocol only needs one call from python.
+// Only scalar values (basic types, enums and pointers) can flow between steps.
+// Tiered functions are called through their current code.
+struct Pipeline
+{
+  Pipeline(dffi::DFFI& D, CFunction& F);
+
+  // Call F with the current value as its first argument. Its other
+  // parameters are appended to the pipeline ones.
+  Pipeline& call(CFunction& F);
+  // Get the field Name of the structure/union pointed by the current value.
+  // Arrays and composite fields are returned as pointers.
+  Pipeline& field(const char* Name);
+  // Returns a zero value from the pipeline if the current value is null.
+  Pipeline& returnIfNull();
+
+  std::string code() const;
+  CFunction build();
+
+private:
+  void callImpl(CFunction& F, bool First);
+  dffi::Type const* curType() const;
+
+  dffi::DFFI& DFFI_;
+  std::string Name_;
+  std::vector<dffi::QualType> Params_;
+  // Called functions, whose bound objects must outlive the pipeline
+  std::vector<CFunction> Funcs_;
+  dffi::Type const* CurTy_;
+  std::stringstream Body_;
+  size_t NVals_;
+  bool HasNullChecks_;
+};
+
+#endif
@@ -25,9 +25,14 @@
 
 namespace py = pybind11;
 
+#include "alloc.h"
 #include "cobj.h"
+#include "columns.h"
 #include "dispatcher.h"
+#include "elementwise.h"
 #include "errors.h"
+#include "mmap.h"
+#include "pipeline.h"
 
 using namespace dffi;
 
@@ -97,45 +102,90 @@ CFunction cu_getfunction(CompilationUnit& CU, const char* Name)
 }
 
 
-std::unique_ptr<CArrayObj> dffi_view(DFFI& D, py::buffer& B)
+std::unique_ptr<CArrayObj> dffi_view(DFFI& D, py::buffer& B, Type const* EltTy, bool Gather)
 {
   auto Info = B.request();
-  if (Info.ndim != 1) {
-    ThrowError<TypeError>() << "buffer should have only one dimension, got " << Info.ndim << "!";
+  if (Info.ndim < 1) {
+    throw TypeError{"buffer should have at least one dimension!"};
   }
-  // Get type from format
-  auto const& Format = Info.format;
-  if (Format.size() != 1) {
-    ThrowError<TypeError>() << "unsupported format " << Format;
+  // If an element type is given (e.g. a structure for a numpy record array),
+  // the layout described by the buffer format must match it.
+  if (EltTy) {
+    if (!formatMatches(Info, EltTy)) {
+      ThrowError<TypeError>() << "buffer format '" << Info.format << "' doesn't match the element type, expected '" << getFormatDescriptor(EltTy) << "'";
+    }
+  }
+  else {
+    // Get type from format
+    auto const& Format = Info.format;
+    if (Format.size() != 1) {
+      ThrowError<TypeError>() << "unsupported format " << Format << ", the element type must be given explicitly";
+    }
+    switch (Format[0]) {
+      #define HANDLE_BTY(Format, CTy)\
+        case Format:\
+          EltTy = D.getBasicType(BasicType::getKind<CTy>());\
+          break;
+      HANDLE_BTY('c', char)
+      HANDLE_BTY('b', signed char)
+      HANDLE_BTY('B', unsigned char)
+      HANDLE_BTY('?', bool)
+      HANDLE_BTY('h', short)
+      HANDLE_BTY('H', unsigned short)
+      HANDLE_BTY('i', int)
+      HANDLE_BTY('I', unsigned int)
+      HANDLE_BTY('l', long)
+      HANDLE_BTY('L', unsigned long)
+      HANDLE_BTY('q', long long)
+      HANDLE_BTY('Q', unsigned long long)
+      HANDLE_BTY('f', float)
+      HANDLE_BTY('d', double)
+      HANDLE_BTY('P', uintptr_t)
+      default:
+        ThrowError<TypeError>() << "unsupported format character " << Format[0];
+    };
   }
-  BasicType const* PteTy = nullptr; 
-  switch (Format[0]) {
-    #define HANDLE_BTY(Format, CTy)\
-      case Format:\
-        PteTy = D.getBasicType(BasicType::getKind<CTy>());\
-        break;
-    HANDLE_BTY('c', char)
-    HANDLE_BTY('b', signed char)
-    HANDLE_BTY('B', unsigned char)
-    HANDLE_BTY('?', bool)
-    HANDLE_BTY('h', short)
-    HANDLE_BTY('H', unsigned short)
-    HANDLE_BTY('i', int)
-    HANDLE_BTY('I', unsigned int)
-    HANDLE_BTY('l', long)
-    HANDLE_BTY('L', unsigned long)
-    HANDLE_BTY('q', long long)
-    HANDLE_BTY('Q', unsigned long long)
-    HANDLE_BTY('f', float)
-    HANDLE_BTY('d', double)
-    HANDLE_BTY('P', uintptr_t)
-    default:
-      ThrowError<TypeError>() << "unsupported format character " << Format[0];
-  };
 
-  return std::unique_ptr<CArrayObj>{new CArrayObj{
-    *D.getArrayType(PteTy, Info.size),
-    Data<void>::view(Info.ptr)}};
+  // Multi-dimensional buffers are mapped to nested arrays
+  Type const* Ty = EltTy;
+  for (ssize_t I = Info.ndim-1; I >= 1; --I) {
+    Ty = D.getArrayType(Ty, Info.shape[I]);
+  }
+  auto* ArrTy = D.getArrayType(Ty, Info.shape[0]);
+  if (isCContiguous(Info)) {
+    return std::unique_ptr<CArrayObj>{new CArrayObj{
+      *ArrTy,
+      Data<void>::view(Info.ptr)}};
+  }
+  if (!Gather) {
+    throw TypeError{"buffer isn't contiguous, use gather=True to get a contiguous copy!"};
+  }
+  std::unique_ptr<CArrayObj> Ret{new CArrayObj{*ArrTy, false}};
+  gatherStrided(Info, Ret->getData());
+  return Ret;
+}
+
+// Strings are UTF-8 encoded once, so that the returned pointers can be given
+// to any number of calls without conversion. The encoded string lives as long
+// as the returned object, and bytes objects are used without any copy.
+std::unique_ptr<CPointerObj> dffi_cstr(DFFI& D, py::handle O)
+{
+  py::bytes Str;
+  if (PyBytes_Check(O.ptr())) {
+    Str = py::reinterpret_borrow<py::bytes>(O);
+  }
+  else if (PyUnicode_Check(O.ptr())) {
+    PyObject* Enc = PyUnicode_AsUTF8String(O.ptr());
+    if (!Enc) {
+      throw py::error_already_set{};
+    }
+    Str = py::reinterpret_steal<py::bytes>(Enc);
+  }
+  else {
+    throw TypeError{"cstr expects a str or bytes object!"};
+  }
+  return std::unique_ptr<CPointerObj>{new CStrObj{
+    *PointerType::get(QualType{D.getCharTy()}.withConst()), std::move(Str)}};
 }
 
 void dffi_dlopen(const char* Path)
@@ -146,16 +196,45 @@ void dffi_dlopen(const char* Path)
   }
 }
 
-std::unique_ptr<DFFI> default_ctor(unsigned optLevel, py::list includeDirs)
+// The python classes generated for the composite types of a DFFI object, and
+// its columns kernels, are released before it is destroyed.
+struct FFIDeleter
+{
+  void operator()(DFFI* D) const
+  {
+    releaseCompositeClasses(D->getCharTy()->getDFFI());
+    unregisterDFFI(*D);
+    delete D;
+  }
+};
+using FFIHolder = std::unique_ptr<DFFI, FFIDeleter>;
+
+FFIHolder default_ctor(unsigned optLevel, py::list includeDirs, bool directTrampolines, bool tieredCompilation, unsigned tierUpThreshold,
+  std::string cpu, py::list features, bool fastMath, bool vectorize, bool unroll, bool profileInstrument, bool openMP, bool keepIR)
 {
   CCOpts Opts;
   Opts.OptLevel = optLevel;
+  Opts.CPU = std::move(cpu);
+  for (py::handle O: features) {
+    Opts.Features.emplace_back(O.cast<std::string>());
+  }
+  Opts.FastMath = fastMath;
+  Opts.Vectorize = vectorize;
+  Opts.Unroll = unroll;
+  Opts.DirectTrampolines = directTrampolines;
+  Opts.TieredCompilation = tieredCompilation;
+  Opts.TierUpThreshold = tierUpThreshold;
+  Opts.ProfileInstrument = profileInstrument;
+  Opts.OpenMP = openMP;
+  Opts.KeepIR = keepIR;
   auto& Dirs = Opts.IncludeDirs;
   Dirs.reserve(py::len(includeDirs));
   for (py::handle O: includeDirs) {
     Dirs.emplace_back(O.cast<std::string>());
   }
-  return std::unique_ptr<DFFI>{new DFFI{Opts}};
+  FFIHolder Ret{new DFFI{Opts}};
+  registerDFFI(*Ret);
+  return Ret;
 }
 
 __attribute__((constructor)) void init()
@@ -163,6 +242,14 @@ __attribute__((constructor)) void init()
   DFFI::initialize();
 }
 
+void cu_optimize_with_profile(CompilationUnit& CU)
+{
+  std::string Err;
+  if (!CU.optimizeWithProfile(Err)) {
+    throwCompileErr(std::move(Err));
+  }
+}
+
 CFunction dffi_getfunction(DFFI& D, FunctionType const& Ty, void* Ptr)
 {
   return CFunction{D.getFunction(&Ty, Ptr)};
@@ -173,6 +260,11 @@ CFunction functiontype_getfunction(FunctionType const& Ty, void* Ptr)
   return CFunction{Ty.getFunction(Ptr)};
 }
 
+std::unique_ptr<CClosure> functiontype_closure(FunctionType const& Ty, py::object Callable)
+{
+  return std::unique_ptr<CClosure>{new CClosure{Ty, std::move(Callable)}};
+}
+
 uintptr_t cpointerobj_getptr(CPointerObj& Obj)
 {
   return (uintptr_t)Obj.getPtr();
@@ -275,7 +367,7 @@ py::object basictype_new(BasicType const& BTy, py::handle O)
   return py::none();
 }
 
-std::unique_ptr<CStructObj> structtype_new(StructType const& STy, py::kwargs KW)
+py::object structtype_new(StructType const& STy, py::kwargs KW)
 {
   std::unique_ptr<CStructObj> Ret(new CStructObj{STy});
   if (KW) {
@@ -284,7 +376,7 @@ std::unique_ptr<CStructObj> structtype_new(StructType const& STy, py::kwargs KW)
     }
   }
 
-  return Ret;
+  return toPyObject(std::move(Ret));
 } 
 
 std::unique_ptr<CPointerObj> cpointerobj_new(PointerType const& PTy)
@@ -357,18 +449,31 @@ PYBIND11_MODULE(pydffi, m)
     ;
 
   py::class_<PointerType>(m, "PointerType", type)
-    .def("pointee", &PointerType::getPointee, py::return_value_policy::reference_internal)
+    .def("pointee", [](PointerType const& PTy) { return PTy.getPointee().getType(); }, py::return_value_policy::reference_internal)
     .def("__call__", cpointerobj_new, py::keep_alive<0,1>())
     ;
 
   py::class_<ArrayType>(m, "ArrayType", type)
     .def("elementType", &ArrayType::getElementType, py::return_value_policy::reference_internal)
+    .def("__call__", [](ArrayType const& ATy) {
+      return std::unique_ptr<CArrayObj>{new CArrayObj{ATy}};
+    }, py::keep_alive<0,1>())
+    ;
+
+  py::class_<VectorType>(m, "VectorType", type)
+    .def("elementType", &VectorType::getElementType, py::return_value_policy::reference_internal)
+    .def_property_readonly("numElements", &VectorType::getNumElements)
+    .def("__call__", [](VectorType const& VTy) {
+      return std::unique_ptr<CVectorObj>{new CVectorObj{VTy}};
+    }, py::keep_alive<0,1>())
     ;
 
   py::class_<FunctionType>(m, "FunctionType", type)
     .def("returnType", &FunctionType::getReturnType, py::return_value_policy::reference_internal)
     .def("params", &FunctionType::getParams, py::return_value_policy::reference_internal)
-    .def("getFunction", functiontype_getfunction, py::keep_alive<0,1>());
+    .def_property_readonly("varArgs", &FunctionType::hasVarArgs)
+    .def("getFunction", functiontype_getfunction, py::keep_alive<0,1>())
+    .def("closure", functiontype_closure, py::keep_alive<0,1>())
     ;
 
   py::class_<CompositeField>(m, "CompositeField")
@@ -406,7 +511,7 @@ PYBIND11_MODULE(pydffi, m)
     ;
 
   py::class_<CObj> cobj(m, "CObj");
-  cobj.def("cast", &CObj::cast, py::keep_alive<0,1>())
+  cobj.def("cast", [](CObj const& O, Type const* To) { return toPyObject(O.cast(To)); }, py::keep_alive<0,1>())
       .def("type", &CObj::getType, py::return_value_policy::reference_internal)
       .def("size", &CObj::getSize)
       .def("align", &CObj::getAlign)
@@ -477,16 +582,24 @@ PYBIND11_MODULE(pydffi, m)
   DECL_CBASICOBJ(double, "Float64", "__float__");
   DECL_CBASICOBJ(long double, "Float128", "__float__");
 
-  py::class_<CPointerObj>(m, "CPointerObj", cobj)
+  py::class_<CPointerObj> cpointerobj(m, "CPointerObj", cobj);
+  cpointerobj
     .def(py::init<PointerType const&>(), py::keep_alive<1, 2>())
     .def_property_readonly("pointeeType", &CPointerObj::getPointeeType, py::return_value_policy::reference_internal)
-    .def_property_readonly("obj", &CPointerObj::getObj)
+    .def_property_readonly("obj", [](CPointerObj& O) { return toPyObject(O.getObj()); })
     .def_property_readonly("value", cpointerobj_getptr)
     .def("__int__", cpointerobj_getptr)
     .def("__long__", cpointerobj_getptr)
     .def(PYBIND11_BOOL_ATTR, [](CPointerObj const& O) -> bool { return O.getPtr() != nullptr; })
     .def("view", &CPointerObj::getMemoryView)
     .def_property_readonly("cstr", &CPointerObj::getMemoryViewCStr)
+    .def("cursor", [](CPointerObj const& O, size_t N) {
+        return std::unique_ptr<CCursor>{new CCursor{O.getPointeeType(), O.getPtr(), N}};
+      }, py::keep_alive<0,1>())
+    ;
+
+  py::class_<CClosure>(m, "CClosure", cpointerobj)
+    .def_property_readonly("callable", &CClosure::getCallable)
     ;
 
   // Composite object
@@ -527,7 +640,16 @@ PYBIND11_MODULE(pydffi, m)
     .def(py::init<ArrayType const&>(), py::keep_alive<1, 2>())
     .def("set", &CArrayObj::set)
     .def("get", &CArrayObj::get)
+    .def("fromIterable", &CArrayObj::fromIterable)
+    .def("toList", &CArrayObj::toList)
+    .def("fromRecords", &CArrayObj::fromRecords)
     .def("elementType", &CArrayObj::getElementType, py::return_value_policy::reference_internal)
+    .def("cursor", [](CArrayObj& O) {
+        auto* Ty = O.getType();
+        return std::unique_ptr<CCursor>{new CCursor{Ty->getElementType(), O.getData(), Ty->getNumElements()}};
+      }, py::keep_alive<0,1>())
+    .def("columns", array_columns, py::arg("fields") = py::none())
+    .def("setColumns", array_set_columns)
     .def_buffer([](CArrayObj& O) {
         auto* EltTy = O.getElementType();
         return py::buffer_info{
@@ -535,7 +657,27 @@ PYBIND11_MODULE(pydffi, m)
           // TODO: using ssize_t is a concern here!
           static_cast<ssize_t>(EltTy->getSize()),
           getFormatDescriptor(EltTy),
-          static_cast<ssize_t>(O.getType()->getSize())
+          static_cast<ssize_t>(O.getType()->getNumElements())
+        };
+      })
+    ;
+
+  // Vector object
+  py::class_<CVectorObj>(m, "CVectorObj", py::buffer_protocol(), cobj)
+    .def(py::init<VectorType const&>(), py::keep_alive<1, 2>())
+    .def("set", &CVectorObj::set)
+    .def("get", &CVectorObj::get)
+    .def("__len__", &CVectorObj::size)
+    .def("__getitem__", &CVectorObj::get)
+    .def("__setitem__", &CVectorObj::set)
+    .def("elementType", &CVectorObj::getElementType, py::return_value_policy::reference_internal)
+    .def_buffer([](CVectorObj& O) {
+        auto* EltTy = O.getElementType();
+        return py::buffer_info{
+          O.getData(),
+          static_cast<ssize_t>(EltTy->getSize()),
+          getFormatDescriptor(EltTy),
+          static_cast<ssize_t>(O.size())
         };
       })
     ;
@@ -543,6 +685,34 @@ PYBIND11_MODULE(pydffi, m)
   py::class_<CFunction>(m, "CFunction", cobj)
     .def("call", &CFunction::call)
     .def("__call__", &CFunction::call)
+    .def_property("typedReturns", &CFunction::hasTypedReturns, &CFunction::setTypedReturns)
+    .def("specialize", &CFunction::specialize, py::keep_alive<0,1>())
+    .def("frame", [](CFunction const& F, py::args const& Args) {
+        if (py::len(Args) > F.getType()->getParams().size()) {
+          throw TypeError{"too many arguments to prefill the frame!"};
+        }
+        std::unique_ptr<CArgsFrame> Ret{new CArgsFrame{F}};
+        size_t I = 0;
+        for (auto& A: Args) {
+          Ret->set(I++, A);
+        }
+        return Ret;
+      }, py::keep_alive<0,1>())
+    ;
+
+  py::class_<CArgsFrame>(m, "CArgsFrame")
+    .def("call", &CArgsFrame::call)
+    .def("__call__", &CArgsFrame::call)
+    .def("__setitem__", &CArgsFrame::set)
+    .def("__getitem__", &CArgsFrame::get)
+    .def("__len__", &CArgsFrame::size)
+    ;
+
+  py::class_<CCursor>(m, "CCursor")
+    .def("__iter__", [](py::object Self) { return Self; })
+    .def("__next__", &CCursor::next)
+    .def("next", &CCursor::next)
+    .def("__len__", &CCursor::size)
     ;
 
   py::class_<CUTypes>(m, "CUTypes")
@@ -562,10 +732,35 @@ PYBIND11_MODULE(pydffi, m)
     .def("getUnionType", &CompilationUnit::getUnionType, py::return_value_policy::reference_internal)
     .def("getEnumType", &CompilationUnit::getEnumType, py::return_value_policy::reference_internal)
     .def("getType", &CompilationUnit::getType, py::return_value_policy::reference_internal)
+    .def("hotFunctions", &CompilationUnit::getHotFunctions)
+    .def("optimizeWithProfile", cu_optimize_with_profile)
+    ;
+
+  py::class_<Pipeline>(m, "Pipeline")
+    .def("call", &Pipeline::call, py::return_value_policy::reference, py::keep_alive<1,2>())
+    .def("field", &Pipeline::field, py::return_value_policy::reference)
+    .def("returnIfNull", &Pipeline::returnIfNull, py::return_value_policy::reference)
+    .def("code", &Pipeline::code)
+    .def("build", &Pipeline::build, py::keep_alive<0,1>())
+    ;
+
+  py::class_<ElementwiseKernel>(m, "ElementwiseKernel")
+    .def("__call__", &ElementwiseKernel::call)
     ;
 
-  py::class_<DFFI>(m, "FFI")
-    .def(py::init(&default_ctor), py::arg("optLevel") = 2, py::arg("includeDirs") = py::list())
+#ifndef _WIN32
+  py::enum_<MmapAdvice>(m, "MmapAdvice")
+    .value("Normal", MmapAdvice::Normal)
+    .value("Sequential", MmapAdvice::Sequential)
+    .value("Random", MmapAdvice::Random)
+    .value("WillNeed", MmapAdvice::WillNeed)
+    ;
+#endif
+
+  py::class_<DFFI, FFIHolder>(m, "FFI")
+    .def(py::init(&default_ctor), py::arg("optLevel") = 2, py::arg("includeDirs") = py::list(), py::arg("directTrampolines") = false, py::arg("tieredCompilation") = false, py::arg("tierUpThreshold") = 1000,
+      py::arg("cpu") = "", py::arg("features") = py::list(), py::arg("fastMath") = false, py::arg("vectorize") = true, py::arg("unroll") = true,
+      py::arg("profileInstrument") = false, py::arg("openMP") = false, py::arg("keepIR") = false)
     .def("cdef", dffi_cdef, py::keep_alive<0,1>())
     .def("cdef", dffi_cdef_no_name, py::keep_alive<0,1>())
     .def("compile", dffi_compile, py::keep_alive<0,1>())
@@ -578,13 +773,24 @@ PYBIND11_MODULE(pydffi, m)
     .def("typeof", [](DFFI&, CObj const& O) { return O.getType(); }, py::return_value_policy::reference_internal)
     .def("sizeof", [](DFFI&, CObj const& O) { return O.getSize(); })
     .def("alignof", [](DFFI&, CObj const& O) { return O.getAlign(); })
-    .def("view", dffi_view, py::keep_alive<0,1>(), py::keep_alive<0,2>())
+    .def("cstr", dffi_cstr, py::keep_alive<0,1>())
+    .def("view", dffi_view, py::arg("buffer"), py::arg("type") = static_cast<Type const*>(nullptr), py::arg("gather") = false, py::keep_alive<0,1>(), py::keep_alive<0,2>())
+#ifndef _WIN32
+    .def("mmap", dffi_mmap, py::arg("path"), py::arg("type"), py::arg("offset") = 0, py::arg("count") = py::none(), py::arg("writable") = false, py::arg("advice") = MmapAdvice::Normal, py::keep_alive<0,1>())
+#endif
     .def("basicType", 
       (BasicType const*(DFFI::*)(BasicType::BasicKind)) &DFFI::getBasicType,
       py::return_value_policy::reference_internal)
     .def("arrayType", &DFFI::getArrayType, py::return_value_policy::reference_internal)
+    .def("vectorType", &DFFI::getVectorType, py::return_value_policy::reference_internal)
     .def("pointerType", &DFFI::getPointerType, py::return_value_policy::reference_internal)
     .def("getFunction", dffi_getfunction, py::keep_alive<0,1>())
+    .def("pipeline", [](DFFI& D, CFunction& F) {
+      return std::unique_ptr<Pipeline>{new Pipeline{D, F}};
+    }, py::keep_alive<0,1>(), py::keep_alive<0,2>())
+    .def("elementwise", [](DFFI& D, std::string Expr, std::string Preamble, unsigned NThreads) {
+      return std::unique_ptr<ElementwiseKernel>{new ElementwiseKernel{D, std::move(Expr), std::move(Preamble), NThreads}};
+    }, py::arg("expr"), py::arg("preamble") = "", py::arg("nthreads") = 0, py::keep_alive<0,1>())
 
     // Basic values
     .def("Int8", createBasicObj<int8_t>, py::keep_alive<0,1>())
@@ -639,6 +845,30 @@ PYBIND11_MODULE(pydffi, m)
 
   m.def("dlopen", dffi_dlopen);
 
+  // Allocation policy of arrays and structures/unions
+  py::class_<AllocPolicy> allocPolicy(m, "AllocPolicy");
+  py::enum_<AllocPolicy::InitKind>(allocPolicy, "Init")
+    .value("Default", AllocPolicy::Default)
+    .value("Uninitialized", AllocPolicy::Uninitialized)
+    .value("Zero", AllocPolicy::Zero)
+    .value("Pattern", AllocPolicy::Pattern)
+    ;
+  allocPolicy
+    .def_readwrite("init", &AllocPolicy::Init)
+    .def_readwrite("pattern", &AllocPolicy::PatternByte)
+    .def_property("align",
+      [](AllocPolicy const& P) { return P.Align; },
+      [](AllocPolicy& P, size_t Align) {
+        if (Align & (Align - 1)) {
+          ThrowError<TypeError>() << "alignment " << Align << " isn't a power of two!";
+        }
+        P.Align = Align;
+      })
+    .def_readwrite("hugePagesThreshold", &AllocPolicy::HugePagesThreshold)
+    .def_readwrite("poolMaxSize", &AllocPolicy::PoolMaxSize)
+    ;
+  m.def("allocPolicy", &getAllocPolicy, py::return_value_policy::reference);
+
   // Exceptions
   py::register_exception<CompileError>(m, "CompileError");
   py::register_exception<UnknownFunctionError>(m, "UnknownFunctionError");
@@ -0,0 +1,85 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Point {
+  int x;
+  int y;
+};
+''')
+U8Ty = F.basicType(pydffi.BasicKind.UInt8)
+Policy = pydffi.allocPolicy()
+
+# Default policy: arrays are filled with a pattern
+assert(Policy.init == pydffi.AllocPolicy.Init.Default)
+A = pydffi.CArrayObj(F.arrayType(U8Ty, 16))
+assert(A.toList() == [0xDD]*16)
+# and vectors are zeroed
+V = F.vectorType(U8Ty, 16)()
+assert([V.get(i) for i in range(16)] == [0]*16)
+
+Policy.init = pydffi.AllocPolicy.Init.Pattern
+Policy.pattern = 0xAB
+A = pydffi.CArrayObj(F.arrayType(U8Ty, 16))
+assert(A.toList() == [0xAB]*16)
+V = F.vectorType(U8Ty, 16)()
+assert([V.get(i) for i in range(16)] == [0xAB]*16)
+
+Policy.init = pydffi.AllocPolicy.Init.Zero
+A = pydffi.CArrayObj(F.arrayType(U8Ty, 16))
+assert(A.toList() == [0]*16)
+P = CU.types.Point()
+assert(P.x == 0 and P.y == 0)
+
+# Explicit alignment
+Policy.align = 64
+for i in range(10):
+    A = pydffi.CArrayObj(F.arrayType(U8Ty, 3))
+    assert(F.ptr(A).value % 64 == 0)
+try:
+    Policy.align = 48
+    assert(False)
+except pydffi.TypeError:
+    pass
+Policy.align = 0
+
+# Big buffers directly mapped, with huge pages if possible
+Policy.hugePagesThreshold = 1 << 20
+N = 4 << 20
+A = pydffi.CArrayObj(F.arrayType(U8Ty, N))
+assert(A.get(0) == 0 and A.get(N-1) == 0)
+A.set(N-1, 5)
+assert(A.get(N-1) == 5)
+del A
+Policy.hugePagesThreshold = 0
+
+# Small structures are recycled
+Policy.poolMaxSize = 256
+P = CU.types.Point(x=1, y=2)
+Addr = F.ptr(P).value
+del P
+P = CU.types.Point(x=3, y=4)
+assert(F.ptr(P).value == Addr)
+assert(P.x == 3 and P.y == 4)
+Policy.poolMaxSize = 0
+
+Policy.init = pydffi.AllocPolicy.Init.Default
+Policy.pattern = 0xDD
@@ -0,0 +1,84 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Point {
+  int x;
+  double y;
+  unsigned char tag;
+};
+''')
+
+N = 10
+IntArr = pydffi.CArrayObj(F.arrayType(F.basicType(pydffi.BasicKind.Int32), N))
+IntArr.fromIterable(list(range(N)))
+assert(IntArr.toList() == list(range(N)))
+IntArr.fromIterable(tuple(-i for i in range(N)))
+assert(IntArr.toList() == [-i for i in range(N)])
+# Any iterable works
+IntArr.fromIterable(range(N, 2*N))
+assert([IntArr.get(i) for i in range(N)] == list(range(N, 2*N)))
+
+DblArr = pydffi.CArrayObj(F.arrayType(F.basicType(pydffi.BasicKind.Float64), N))
+DblArr.fromIterable([i*0.5 for i in range(N)])
+assert(DblArr.toList() == [i*0.5 for i in range(N)])
+# Ints are converted to floats by the generic path
+DblArr.fromIterable(list(range(N)))
+assert(DblArr.toList() == [float(i) for i in range(N)])
+
+U8Arr = pydffi.CArrayObj(F.arrayType(F.basicType(pydffi.BasicKind.UInt8), 3))
+for Invalid in ([1, 2, 256], [1, 2, -1], [1, 2, 3, 4], [1, 2, "a"]):
+    try:
+        U8Arr.fromIterable(Invalid)
+        assert(False)
+    except (pydffi.TypeError, RuntimeError):
+        pass
+
+PArr = pydffi.CArrayObj(F.arrayType(CU.types.Point, 3))
+PArr.fromRecords([(1, 1.5, 10), {"x": 2, "y": 2.5, "tag": 20}, [3, 3.5, 30]])
+assert([(P.x, P.y, P.tag) for P in PArr.toList()] == [(1, 1.5, 10), (2, 2.5, 20), (3, 3.5, 30)])
+
+# Fields missing from dicts are left untouched
+PArr.fromRecords([{"x": 4}, {"y": 5.5}, {}])
+assert([(P.x, P.y, P.tag) for P in PArr.toList()] == [(4, 1.5, 10), (2, 5.5, 20), (3, 3.5, 30)])
+
+try:
+    PArr.fromRecords([{"z": 1}, {}, {}])
+    assert(False)
+except RuntimeError:
+    pass
+try:
+    PArr.fromRecords([(1, 2.0), (1, 2.0, 3), (1, 2.0, 3)])
+    assert(False)
+except pydffi.TypeError:
+    pass
+# Invalid values don't leave the array half-updated
+try:
+    PArr.fromRecords([(7, 7.5, 70), (8, 8.5, 80), (9, 9.5, "a")])
+    assert(False)
+except (pydffi.TypeError, RuntimeError):
+    pass
+assert([(P.x, P.y, P.tag) for P in PArr.toList()] == [(4, 1.5, 10), (2, 5.5, 20), (3, 3.5, 30)])
+try:
+    IntArr.fromRecords([{}]*N)
+    assert(False)
+except pydffi.TypeError:
+    pass
@@ -0,0 +1,59 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <string.h>
+
+typedef int(*cb_ty)(int);
+
+int apply(int a, const char* s, cb_ty cb, int b) {
+  return cb(a) + b + (int)strlen(s);
+}
+
+int add(int a, int b) { return a+b; }
+
+int sum8(int a, int b, int c, int d, int e, int f, int g, int h) {
+  return a+b+c+d+e+f+g+h;
+}
+''')
+
+# Temporaries of nested calls (here, from a python callback) must not
+# overwrite the ones of the outer call.
+def cb(x):
+    return CU.funcs.add(x, 100).value
+assert(CU.funcs.apply(1, "abc", cb, 2).value == 101+2+3)
+
+def nested(x):
+    return CU.funcs.apply(x, "de", cb, 10).value
+assert(CU.funcs.apply(1, "abc", nested, 2).value == (101+10+2)+2+3)
+
+# Many calls reuse the same memory
+for i in range(10000):
+    assert(CU.funcs.sum8(i, 1, 2, 3, 4, 5, 6, 7).value == i+28)
+
+# Errors in the middle of conversions release the temporaries
+for i in range(100):
+    try:
+        CU.funcs.sum8(1, 2, 3, 4, "a", 6, 7, 8)
+        assert(False)
+    except RuntimeError:
+        pass
+assert(CU.funcs.add(1, 2).value == 3)
@@ -0,0 +1,75 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stdlib.h>
+
+typedef int(*cmp_ty)(const void*, const void*);
+typedef int(*op_ty)(int, int);
+typedef void(*cb_ty)(void);
+
+void sort(int* a, size_t n, cmp_ty cmp) {
+  qsort(a, n, sizeof(int), cmp);
+}
+
+int call(op_ty f, int a, int b) {
+  return f(a,b);
+}
+
+void call_cb(cb_ty f) { f(); }
+''')
+
+IntPtrTy = F.ptr(F.basicType(pydffi.BasicKind.Int32))
+
+# Explicit closures
+OpTy = CU.types.op_ty.pointee()
+add = OpTy.closure(lambda a,b: a+b)
+assert(CU.funcs.call(add, 1, 4).value == 5)
+assert(CU.funcs.call(add, 10, 4).value == 14)
+
+# Python callables are automatically wrapped
+assert(CU.funcs.call(lambda a,b: a*b, 3, 4).value == 12)
+
+called = []
+CU.funcs.call_cb(lambda: called.append(True))
+assert(called == [True])
+
+# qsort with a python comparator
+def cmp(a, b):
+    a = a.cast(IntPtrTy).obj.value
+    b = b.cast(IntPtrTy).obj.value
+    return (a > b) - (a < b)
+data = F.arrayType(F.basicType(pydffi.BasicKind.Int32), 5)()
+for i,v in enumerate((4,1,3,5,2)):
+    data.set(i, v)
+CU.funcs.sort(F.ptr(data).cast(IntPtrTy), 5, cmp)
+assert([data.get(i) for i in range(5)] == [1,2,3,4,5])
+
+# Lots of closures alive at the same time
+ops = [OpTy.closure(lambda a,b,i=i: a+b+i) for i in range(100)]
+for i,op in enumerate(ops):
+    assert(CU.funcs.call(op, 1, 2).value == i+3)
+
+# Exceptions can't go through C code: they are reported and a zero value is
+# returned.
+def raises(a,b):
+    raise RuntimeError("error")
+assert(CU.funcs.call(raises, 1, 2).value == 0)
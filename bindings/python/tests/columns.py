@@ -0,0 +1,103 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import sys
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Record {
+  char tag;
+  int id;
+  double value;
+  short pos[2];
+};
+
+union U {
+  int i;
+  float f;
+};
+''')
+
+N = 100
+A = pydffi.CArrayObj(F.arrayType(CU.types.Record, N))
+for i in range(N):
+    R = A.get(i)
+    R.tag = i % 64
+    R.id = i
+    R.value = i*0.5
+    R.pos.set(0, i)
+    R.pos.set(1, -i)
+
+Cols = A.columns(fields=["id", "value"])
+assert(sorted(Cols.keys()) == ["id", "value"])
+assert(list(memoryview(Cols["id"])) == list(range(N)))
+assert(list(memoryview(Cols["value"])) == [i*0.5 for i in range(N)])
+
+# All the fields by default, and kernels are reused for the same layout
+Cols = A.columns()
+assert(sorted(Cols.keys()) == ["id", "pos", "tag", "value"])
+Pos = Cols["pos"]
+assert(Pos.get(3).get(0) == 3 and Pos.get(3).get(1) == -3)
+
+# Scatter columns back into the structures
+Ids = Cols["id"]
+for i in range(N):
+    Ids.set(i, N-i)
+A.setColumns({"id": Ids})
+assert(A.get(0).id == N)
+assert(A.get(N-1).id == 1)
+assert(A.get(N-1).value == (N-1)*0.5)
+
+Cols["value"].set(10, 42.0)
+A.setColumns({"value": Cols["value"], "tag": Cols["tag"]})
+assert(A.get(10).value == 42.0)
+assert(A.get(11).value == 5.5)
+
+try:
+    A.setColumns({"id": Cols["value"]})
+    assert(False)
+except pydffi.TypeError:
+    pass
+
+# Columns can't alias the array
+if sys.version_info >= (3, 0):
+    Alias = memoryview(A).cast('B').cast('i')[:N]
+    try:
+        A.setColumns({"id": Alias})
+        assert(False)
+    except pydffi.TypeError:
+        pass
+    assert(A.get(0).id == N)
+
+try:
+    A.columns(fields=["nope"])
+    assert(False)
+except RuntimeError:
+    pass
+
+try:
+    pydffi.CArrayObj(F.arrayType(F.basicType(pydffi.BasicKind.Int32), 4)).columns()
+    assert(False)
+except pydffi.TypeError:
+    pass
+
+UArr = pydffi.CArrayObj(F.arrayType(CU.types.U, 4))
+for i in range(4):
+    UArr.get(i).i = i
+assert(list(memoryview(UArr.columns(["i"])["i"])) == [0,1,2,3])
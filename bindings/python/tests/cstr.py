@@ -0,0 +1,56 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# -*- coding: utf8 -*-
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stddef.h>
+size_t my_strlen(const char* s) {
+  size_t ret = 0;
+  while (*s++) ++ret;
+  return ret;
+}
+''')
+my_strlen = CU.funcs.my_strlen
+
+# str objects are UTF-8 encoded, and the encoding is reused by further calls
+S = u"héllo"
+assert(my_strlen(S) == 6)
+assert(my_strlen(S) == 6)
+assert(my_strlen(b"hello") == 5)
+assert(my_strlen(bytearray(b"hello\0")) == 5)
+
+# Pre-encoded strings, which live as long as the returned pointers
+P = F.cstr(u"héllo")
+assert(my_strlen(P) == 6)
+assert(my_strlen(P) == 6)
+assert(bytes(P.cstr) == u"héllo".encode("utf8"))
+
+# bytes objects are used as is
+B = b"other"
+P = F.cstr(B)
+del B
+assert(my_strlen(P) == 5)
+assert(bytes(P.cstr) == b"other")
+
+try:
+    F.cstr(1)
+    assert(False)
+except pydffi.TypeError:
+    pass
@@ -0,0 +1,68 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Point {
+  int x;
+  int y;
+};
+
+void init(struct Point* pts, unsigned n) {
+  for (unsigned i = 0; i < n; ++i) {
+    pts[i].x = i;
+    pts[i].y = 2*i;
+  }
+}
+''')
+
+N = 1000
+Pts = F.arrayType(CU.types.Point, N)()
+CU.funcs.init(F.ptr(Pts).cast(F.ptr(CU.types.Point)), N)
+
+# The same view object is moved over each element
+C = Pts.cursor()
+assert(len(C) == N)
+views = set()
+sx = 0
+sy = 0
+for P in C:
+    views.add(id(P))
+    sx += P.x
+    sy += P.y
+assert(len(views) == 1)
+assert(sx == N*(N-1)//2)
+assert(sy == N*(N-1))
+assert(len(C) == 0)
+
+# Elements can be modified through the view
+for P in Pts.cursor():
+    P.x = -P.x
+assert(Pts.get(10).x == -10)
+
+# Pointer ranges
+ptr = F.ptr(Pts).cast(F.ptr(CU.types.Point))
+assert(sum(P.y for P in ptr.cursor(10)) == 90)
+
+# Scalars are returned as python values
+Ints = F.arrayType(F.Int32Ty, 4)()
+for i in range(4):
+    Ints.set(i, i*i)
+assert(list(Ints.cursor()) == [0, 1, 4, 9])
@@ -0,0 +1,49 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI(directTrampolines=True)
+CU = F.compile('''
+#include <stdint.h>
+
+typedef struct {
+  int a;
+  double b;
+} S;
+
+static int add(int a, int b) { return a+b; }
+S make_s(int a, double b) { S ret = {a,b}; return ret; }
+uint64_t mul(uint64_t a, uint64_t b) { return a*b; }
+''')
+
+assert(CU.funcs.add(1,4).value == 5)
+assert(CU.funcs.mul(3,4).value == 12)
+s = CU.funcs.make_s(1,2.5)
+assert(s.a == 1)
+assert(s.b == 2.5)
+
+# Function pointers still point to the original functions
+CU2 = F.compile('''
+typedef int(*op)(int,int);
+int call(op f, int a, int b) { return f(a,b); }
+''')
+assert(CU2.funcs.call(F.ptr(CU.funcs.add), 1, 2).value == 3)
+
+CU = F.cdef("#include <stdlib.h>")
+assert(CU.funcs.abs(-4).value == 4)
@@ -0,0 +1,69 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import array
+import math
+
+F = pydffi.FFI()
+
+N = 100000
+a = array.array('f', (float(i) for i in range(N)))
+b = array.array('d', (2.0 for i in range(N)))
+c = array.array('i', (i%10 for i in range(N)))
+out = array.array('d', bytes(8*N))
+
+K = F.elementwise("out = a*b + sqrt(c)")
+K(out=out, a=a, b=b, c=c)
+for i in range(N):
+    assert(out[i] == a[i]*2.0 + math.sqrt(i%10))
+
+# Same signature, other buffers
+a2 = array.array('f', (1.0 for i in range(N)))
+K(a=a2, b=b, c=c, out=out)
+assert(out[1] == 2.0 + 1.0)
+
+# Scalars and in-place updates
+K = F.elementwise("x = x*k + o", nthreads=3)
+x = array.array('i', range(N))
+K(x=x, k=3, o=1)
+for i in range(N):
+    assert(x[i] == i*3 + 1)
+
+# Preamble
+K = F.elementwise("y = clamp(y, lo, hi)", preamble="static inline double clamp(double v, double l, double h) { return v < l ? l : (v > h ? h : v); }")
+y = array.array('d', (float(i) for i in range(-5, 6)))
+K(y=y, lo=-1.0, hi=2.5)
+assert(list(y) == [-1.0]*5 + [0.0, 1.0, 2.0, 2.5, 2.5, 2.5])
+
+# Errors
+try:
+    F.elementwise("out = a")(out=out, a=array.array('d', [1.0]))
+    assert(False)
+except pydffi.TypeError:
+    pass
+try:
+    F.elementwise("k = a")(k=1, a=a)
+    assert(False)
+except pydffi.TypeError:
+    pass
+try:
+    F.elementwise("out = a +")(out=out, a=a)
+    assert(False)
+except pydffi.CompileError:
+    pass
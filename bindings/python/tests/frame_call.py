@@ -0,0 +1,63 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stdint.h>
+typedef struct {
+  int x;
+  int y;
+} Point;
+
+double mix(char c, double d, short s, Point p, int64_t i) {
+  return c + d + s + p.x*p.y + i;
+}
+
+size_t len(const char* s) {
+  size_t ret = 0;
+  for (; *s; ++s) ++ret;
+  return ret;
+}
+''')
+
+mix = CU.funcs.mix
+frame = mix.frame(1, 2.5, 3)
+assert(len(frame) == 5)
+P = CU.types.Point()
+P.x = 4
+P.y = 5
+frame[3] = P
+frame[4] = 6
+assert(frame[1] == 2.5)
+assert(frame().value == 32.5)
+frame[4] = 10
+assert(frame.call().value == 36.5)
+
+# Strings are kept alive by the frame
+flen = CU.funcs.len.frame("hello" + " world")
+assert(flen().value == 11)
+assert(flen().value == 11)
+
+err = False
+try:
+    frame[5] = 1
+except pydffi.TypeError:
+    err = True
+assert(err)
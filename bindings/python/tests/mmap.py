@@ -0,0 +1,90 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import os
+import struct
+import tempfile
+import pydffi
+import sys
+
+if not hasattr(pydffi.FFI, "mmap"):
+    sys.exit(0)
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Rec {
+  int id;
+  double v;
+};
+
+double sum(struct Rec const* R, unsigned N) {
+  double Ret = 0;
+  for (unsigned i = 0; i < N; ++i)
+    Ret += R[i].v;
+  return Ret;
+}
+''')
+RecTy = CU.types.Rec
+N = 1000
+
+Fd, Path = tempfile.mkstemp()
+with os.fdopen(Fd, "wb") as f:
+    f.write(b"HEADER\0\0")
+    for i in range(N):
+        f.write(struct.pack("=i4xd", i, i*0.5))
+
+try:
+    A = F.mmap(Path, RecTy, offset=8, advice=pydffi.MmapAdvice.Sequential)
+    assert(F.sizeof(A) == 16*N)
+    assert(A.get(0).id == 0)
+    assert(A.get(N-1).id == N-1 and A.get(N-1).v == (N-1)*0.5)
+    assert(CU.funcs.sum(A, N) == sum(i*0.5 for i in range(N)))
+
+    # Private mappings aren't written back
+    A.get(0).id = 42
+    assert(A.get(0).id == 42)
+    del A
+    A = F.mmap(Path, RecTy, offset=8, count=10, advice=pydffi.MmapAdvice.Random)
+    assert(F.sizeof(A) == 16*10)
+    assert(A.get(0).id == 0)
+
+    # Shared mappings are
+    A = F.mmap(Path, RecTy, offset=8+16*(N-1), count=1, writable=True)
+    A.get(0).v = 1.5
+    del A
+    with open(Path, "rb") as f:
+        f.seek(8+16*(N-1))
+        assert(struct.unpack("=i4xd", f.read(16)) == (N-1, 1.5))
+
+    # Pointers to the mapping keep it alive
+    P = F.ptr(F.mmap(Path, F.CharTy, count=6))
+    assert(P.view(6).tobytes() == b"HEADER")
+
+    for Args in ((RecTy, 4, None), (RecTy, 8, N+1), (RecTy, 1 << 20, None), (F.pointerType(F.CharTy), 0, None)):
+        try:
+            F.mmap(Path, Args[0], offset=Args[1], count=Args[2])
+            assert(False)
+        except pydffi.TypeError:
+            pass
+    try:
+        F.mmap(Path + ".missing", RecTy)
+        assert(False)
+    except OSError:
+        pass
+finally:
+    os.unlink(Path)
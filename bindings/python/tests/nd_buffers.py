@@ -0,0 +1,70 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import struct
+
+F = pydffi.FFI()
+CU = F.compile('''
+int sum(int const* a, unsigned n) {
+  int ret = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    ret += a[i];
+  }
+  return ret;
+}
+
+int sum_cols(int const (*a)[3], unsigned n, unsigned col) {
+  int ret = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    ret += a[i][col];
+  }
+  return ret;
+}
+''')
+
+Buf = bytearray(struct.pack("6i", 1, 2, 3, 4, 5, 6))
+M = memoryview(Buf).cast("B").cast("i", [2, 3])
+
+# Multi-dimensional buffers are viewed as nested arrays, without copies
+V = F.view(M)
+assert(V.get(1).get(2) == 6)
+V.get(1).set(0, 40)
+assert(struct.unpack("6i", bytes(Buf))[3] == 40)
+
+# ... and can be given to pointers to their elements or to their rows
+assert(CU.funcs.sum(M, 6) == 1+2+3+40+5+6)
+assert(CU.funcs.sum_cols(M, 2, 0) == 41)
+assert(CU.funcs.sum_cols(M, 2, 2) == 9)
+
+# Non-contiguous buffers need an explicit copy
+S = memoryview(Buf).cast("i")[::2]
+try:
+    F.view(S)
+    assert(False)
+except pydffi.TypeError:
+    pass
+try:
+    CU.funcs.sum(S, 3)
+    assert(False)
+except pydffi.TypeError:
+    pass
+
+G = F.view(S, gather=True)
+assert([G.get(i) for i in range(3)] == [1, 3, 5])
+assert(CU.funcs.sum(G, 3) == 9)
@@ -0,0 +1,43 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+# REQUIRES: openmp
+#
+
+import pydffi
+
+F = pydffi.FFI(openMP=True)
+CU = F.compile('''
+#include <omp.h>
+void square(int* v, int n) {
+  #pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    v[i] *= v[i];
+  }
+}
+int max_threads() { return omp_get_max_threads(); }
+''')
+
+assert(CU.funcs.max_threads().value >= 1)
+
+Int32Ty = F.basicType(pydffi.BasicKind.Int32)
+N = 1000
+data = F.arrayType(Int32Ty, N)()
+for i in range(N):
+    data.set(i, i)
+CU.funcs.square(F.ptr(data).cast(F.ptr(Int32Ty)), N)
+for i in range(N):
+    assert(data.get(i) == i*i)
@@ -0,0 +1,47 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI(profileInstrument=True)
+CU = F.compile('''
+static unsigned calls = 0;
+int abs_(int v) {
+  ++calls;
+  return v < 0 ? -v : v;
+}
+int unused(int v) { return v; }
+unsigned get_calls() { return calls; }
+''')
+
+for i in range(100):
+    assert(CU.funcs.abs_(i-50).value == abs(i-50))
+assert(CU.hotFunctions() == [("abs_", 100)])
+
+CU.optimizeWithProfile()
+for i in range(100):
+    assert(CU.funcs.abs_(i-50).value == abs(i-50))
+assert(CU.funcs.get_calls().value == 200)
+
+F = pydffi.FFI()
+CU = F.compile("int f(int a) { return a; }")
+try:
+    CU.optimizeWithProfile()
+    assert(False)
+except pydffi.CompileError:
+    pass
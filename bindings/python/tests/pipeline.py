@@ -0,0 +1,86 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import gc
+import re
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stddef.h>
+
+struct Node {
+  int value;
+  char name[8];
+  struct Node* next;
+};
+
+static struct Node nodes[3] = {
+  {1, "one", &nodes[1]},
+  {2, "two", &nodes[2]},
+  {3, "three", NULL},
+};
+
+struct Node* first() { return &nodes[0]; }
+struct Node* next(struct Node* n) { return n->next; }
+int add(int a, int b) { return a+b; }
+int apply(int(*f)(int), int v) { return f(v); }
+''')
+
+# Follow the linked list and get the value of the next node
+next_value = F.pipeline(CU.funcs.next).returnIfNull().field("value").build()
+n = CU.funcs.first()
+assert(next_value(n).value == 2)
+n = CU.funcs.next(n)
+assert(next_value(n).value == 3)
+n = CU.funcs.next(n)
+assert(next_value(n).value == 0)
+
+# Arrays are returned as pointers
+next_name = F.pipeline(CU.funcs.next).returnIfNull().field("name").build()
+assert(next_name(CU.funcs.first()).cstr.tobytes() == b"two")
+
+# Extra parameters of chained calls are appended to the pipeline ones
+P = F.pipeline(CU.funcs.first).field("value").call(CU.funcs.add)
+assert(re.search(r"__dffi_pipeline_[0-9]+\(int32_t __a0\)", P.code()))
+add_first = P.build()
+assert(add_first(10).value == 11)
+
+# Called functions, and the objects bound to them, live as long as the
+# pipeline functions
+twice = CU.funcs.apply.specialize(arg0=lambda v: v*2)
+add_twice = F.pipeline(twice).call(CU.funcs.add).build()
+del twice
+gc.collect()
+assert(add_twice(5, 1).value == 11)
+
+# Pipelines only work on scalar values
+err = False
+try:
+    F.pipeline(CU.funcs.first).field("value").field("value")
+except pydffi.TypeError:
+    err = True
+assert(err)
+
+# The current value must match the first parameter of the called function
+err = False
+try:
+    F.pipeline(CU.funcs.first).call(CU.funcs.add)
+except pydffi.TypeError:
+    err = True
+assert(err)
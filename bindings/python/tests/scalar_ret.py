@@ -0,0 +1,66 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+enum E {
+  A = 1,
+  B = 2
+};
+
+int add(int a, int b) { return a+b; }
+double half(double v) { return v/2; }
+enum E getB() { return B; }
+int apply(int(*f)(int), int v) { return f(v)+1; }
+''')
+
+add = CU.funcs.add
+assert(add(1,2).value == 3)
+
+# Objects still referenced by python must not be reused
+a = add(1,2)
+b = add(3,4)
+assert(a.value == 3)
+assert(b.value == 7)
+
+add.typedReturns = False
+r = add(4,5)
+assert(not isinstance(r, pydffi.CObj))
+assert(r == 9)
+
+half = CU.funcs.half
+half.typedReturns = False
+assert(half(5.0) == 2.5)
+
+getB = CU.funcs.getB
+getB.typedReturns = False
+assert(getB() == 2)
+
+# Reentrant calls don't write into the object of the outer call
+apply = CU.funcs.apply
+Kept = []
+def cb(v):
+    if v == 0:
+        return 0
+    R = apply(cb, v-1)
+    Kept.append(R)
+    return R.value
+assert(apply(cb, 3).value == 4)
+assert([R.value for R in Kept] == [1,2,3])
@@ -0,0 +1,71 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI(keepIR=True)
+CU = F.compile('''
+#include <string.h>
+
+int op(int mode, int a, int b) {
+  switch (mode) {
+    case 0: return a+b;
+    case 1: return a-b;
+    default: return a*b;
+  }
+}
+
+size_t count(const char* s, char c) {
+  size_t ret = 0;
+  for (; *s; ++s) ret += (*s == c);
+  return ret;
+}
+
+int apply(int(*f)(int), int v) { return f(v); }
+''')
+
+sub = CU.funcs.op.specialize(arg0=1)
+assert(sub(10, 4).value == 6)
+sub_from_10 = sub.specialize(arg0=10)
+assert(sub_from_10(4).value == 6)
+mul_by_3 = CU.funcs.op.specialize(arg0=2, arg2=3)
+assert(mul_by_3(5).value == 15)
+
+# Bound strings are kept alive by the specialized function
+count_a = CU.funcs.count.specialize(arg0="banana")
+assert(count_a('a').value == 3)
+assert(count_a('n').value == 2)
+
+# Closures created for bound callables live as long as the specialized
+# function, even after other calls reused the temporary arguments memory
+twice = CU.funcs.apply.specialize(arg0=lambda v: v*2)
+for i in range(100):
+    assert(CU.funcs.apply(lambda v: v+1, i).value == i+1)
+assert(twice(21).value == 42)
+
+# Native functions without IR are called through their address
+CU = F.cdef("#include <string.h>")
+len_hello = CU.funcs.strlen.specialize(arg0="hello")
+assert(len_hello().value == 5)
+
+err = False
+try:
+    sub.specialize(foo=1)
+except pydffi.TypeError:
+    err = True
+assert(err)
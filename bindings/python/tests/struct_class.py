@@ -0,0 +1,79 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Point {
+  int x;
+  int y;
+};
+
+struct Rect {
+  struct Point a;
+  struct Point b;
+  unsigned type;
+};
+
+union U {
+  int i;
+  float f;
+};
+
+int area(struct Rect r) { return (r.b.x-r.a.x)*(r.b.y-r.a.y); }
+struct Point origin() { struct Point ret = {0, 0}; return ret; }
+int get_i(union U u) { return u.i; }
+
+struct WithAnon {
+  struct { int a; } inner;
+};
+''')
+
+P = CU.types.Point(x=1, y=2)
+# Each structure type gets its own python class, with a property per field
+assert(isinstance(P, pydffi.CStructObj))
+assert(type(P) is not pydffi.CStructObj)
+assert(type(P).__name__ == "Point")
+assert(isinstance(type(P).__dict__['x'], property))
+assert(type(CU.types.Point()) is type(P))
+assert(P.x == 1 and P.y == 2)
+P.x = 10
+assert(P.x == 10)
+
+R = CU.types.Rect()
+R.b.x = 4
+R.b.y = 3
+assert(type(R.a) is type(P))
+assert(CU.funcs.area(R) == 12)
+assert(type(CU.funcs.origin()) is type(P))
+# Fields don't hide the methods of C objects
+assert(R.type().size == R.size())
+
+U = F.ptr(P).cast(F.ptr(CU.types.U)).obj
+assert(isinstance(U, pydffi.CUnionObj))
+assert(type(U).__name__ == "U")
+assert(type(CU.types.WithAnon().inner).__name__.startswith("struct_"))
+assert(U.i == 10)
+
+err = False
+try:
+    P.z = 1
+except Exception:
+    err = True
+assert(err)
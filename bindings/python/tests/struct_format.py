@@ -0,0 +1,108 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import struct
+import sys
+
+F = pydffi.FFI()
+CU = F.compile('''
+struct Point {
+  short a;
+  short b;
+};
+
+struct S {
+  char c;
+  int i;
+  double d;
+  float arr[2][3];
+  struct Point p;
+  _Complex double z;
+  int* ptr;
+};
+
+union U {
+  int i;
+  float f;
+};
+
+int sum_i(struct S* s, unsigned n) {
+  int ret = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    ret += s[i].i;
+  }
+  return ret;
+}
+''')
+
+N = 4
+SArrTy = F.arrayType(CU.types.S, N)
+A = pydffi.CArrayObj(SArrTy)
+for i in range(N):
+    A.get(i).i = i+1
+
+# Arrays of structures export a PEP 3118 structured format, with explicit
+# padding, nested structures and fixed-size arrays.
+m = memoryview(A)
+PtrFmt = "Q" if struct.calcsize("P") == 8 else "I"
+assert(m.format == "^T{b:c:3xi:i:d:d:(2,3)f:arr:T{h:a:h:b:}:p:4xZd:z:%s:ptr:}" % PtrFmt)
+assert(m.itemsize == F.sizeof(A.get(0)))
+assert(len(m) == N)
+
+# Unions have no PEP 3118 equivalent and are exposed as raw bytes
+UArr = pydffi.CArrayObj(F.arrayType(CU.types.U, 2))
+assert(memoryview(UArr).format == "(4)B")
+
+# The reverse direction: view a structured buffer as an array of structures
+V = F.view(memoryview(A), CU.types.S)
+assert(V.get(2).i == 3)
+V.get(2).i = 10
+assert(A.get(2).i == 10)
+assert(CU.funcs.sum_i(A, N) == 17)
+
+try:
+    F.view(memoryview(A), CU.types.Point)
+    assert(False)
+except pydffi.TypeError:
+    pass
+
+try:
+    F.view(memoryview(A))
+    assert(False)
+except pydffi.TypeError:
+    pass
+
+try:
+    import numpy
+except ImportError:
+    sys.exit(0)
+
+# Arrays of structures map to numpy record arrays without copies
+R = numpy.asarray(A)
+assert(R.dtype.names == ("c","i","d","arr","p","z","ptr"))
+assert(R["arr"].shape == (N,2,3))
+assert(list(R["i"]) == [1,2,10,4])
+R["i"][0] = 5
+assert(A.get(0).i == 5)
+
+PointDT = numpy.dtype([("a", numpy.int16), ("b", numpy.int16)])
+P = numpy.zeros(3, dtype=PointDT)
+PV = F.view(P, CU.types.Point)
+PV.get(1).b = 42
+assert(P["b"][1] == 42)
@@ -0,0 +1,38 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import time
+
+F = pydffi.FFI(tieredCompilation=True, tierUpThreshold=10)
+CU = F.compile('''
+static unsigned calls = 0;
+int sum(int n) {
+  ++calls;
+  int ret = 0;
+  for (int i = 0; i < n; ++i) ret += i;
+  return ret;
+}
+unsigned get_calls() { return calls; }
+''')
+
+for i in range(500):
+    assert(CU.funcs.sum(10).value == 45)
+    if i % 100 == 0:
+        time.sleep(0.005)
+assert(CU.funcs.get_calls().value == 500)
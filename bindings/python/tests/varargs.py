@@ -0,0 +1,76 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+
+F = pydffi.FFI()
+CU = F.compile('''
+#include <stdarg.h>
+
+int sum(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  int ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret += va_arg(args, int);
+  }
+  va_end(args);
+  return ret;
+}
+
+double fsum(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  double ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret += va_arg(args, double);
+  }
+  va_end(args);
+  return ret;
+}
+''')
+
+assert(CU.funcs.sum.type().varArgs)
+assert(CU.funcs.sum(0).value == 0)
+assert(CU.funcs.sum(3, 1, 2, 4).value == 7)
+# The second call with the same shape reuses the same trampoline
+assert(CU.funcs.sum(3, 10, 20, 40).value == 70)
+# C objects keep their types, and are promoted like in C
+assert(CU.funcs.sum(2, F.Int16Ty(5), F.Int8Ty(6)).value == 11)
+assert(CU.funcs.fsum(2, 1.5, F.Float32Ty(2.25)).value == 3.75)
+
+CU = F.cdef("#include <stdio.h>")
+buf = bytearray(64)
+n = CU.funcs.snprintf(F.view(buf).cast(F.CharPtrTy), len(buf), "%d %.2f %s %lld", 42, 1.5, "dffi", 1<<40)
+s = b"42 1.50 dffi 1099511627776"
+assert(n.value == len(s))
+assert(bytes(buf[:len(s)]) == s)
+
+err = False
+try:
+    CU.funcs.snprintf()
+except pydffi.TypeError:
+    err = True
+assert(err)
+
+err = False
+try:
+    CU.funcs.printf("%p", object())
+except pydffi.TypeError:
+    err = True
+assert(err)
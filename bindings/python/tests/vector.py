@@ -0,0 +1,49 @@
+# Copyright 2018 Adrien Guinet <adrien@guinet.me>
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+# RUN: "%python" "%s"
+#
+
+import pydffi
+import array
+
+F = pydffi.FFI()
+CU = F.compile('''
+typedef float v4f __attribute__((vector_size(16)));
+v4f fma4(v4f a, v4f b, v4f c) { return a*b + c; }
+float hsum(v4f v) { return v[0] + v[1] + v[2] + v[3]; }
+''')
+
+V4FTy = CU.funcs.fma4.type().returnType()
+assert(isinstance(V4FTy, pydffi.VectorType))
+assert(V4FTy.numElements == 4)
+assert(V4FTy.size == 16 and V4FTy.align == 16)
+
+a = V4FTy()
+for i in range(4):
+    a[i] = i
+assert(len(a) == 4)
+
+# Lanes can be given as vector objects, sequences or buffers
+r = CU.funcs.fma4(a, [2.0]*4, array.array('f', [1.0]*4))
+assert([r[i] for i in range(4)] == [1.0, 3.0, 5.0, 7.0])
+assert(list(memoryview(r)) == [1.0, 3.0, 5.0, 7.0])
+assert(CU.funcs.hsum(r).value == 16.0)
+
+try:
+    CU.funcs.hsum([1.0, 2.0])
+    assert(False)
+except pydffi.TypeError:
+    pass
@@ -8,10 +8,11 @@ dir_ = CU.funcs.opendir(sys.argv[1])
 if not dir_:
     print("error reading directory")
     sys.exit(1)
-readdir = CU.funcs.readdir
+# readdir, null check and d_name extraction in a single native call
+next_name = D.pipeline(CU.funcs.readdir).returnIfNull().field("d_name").build()
 while True:
-    dirent = readdir(dir_)
-    if not dirent:
+    name = next_name(dir_)
+    if not name:
         break
-    print(dirent.obj.d_name.cast(D.CharPtrTy).cstr.tobytes())
+    print(name.cstr.tobytes())
 CU.funcs.closedir(dir_)
@@ -53,10 +53,15 @@ private:
 
 class DFFI_API CanOpaqueType: public Type
 {
+  friend class details::CUImpl;
+
 public:
   CanOpaqueType(details::DFFIImpl& Dffi, TypeKind Ty);
 
   bool isOpaque() const { return IsOpaque_; }
+  // Name of the type in its compilation unit (without the struct, union or
+  // enum keyword), or an empty string for anonymous types.
+  std::string const& getName() const { return Name_; }
 
   static bool classof(Type const* T) {
     const auto Kind = T->getKind();
@@ -66,6 +71,7 @@ public:
 protected:
   void setAsDefined() { IsOpaque_ = false; }
 private:
+  std::string Name_;
   bool IsOpaque_;
 };
 
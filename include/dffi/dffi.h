@@ -31,6 +31,7 @@ class Type;
 class BasicType;
 class PointerType;
 class ArrayType;
+class VectorType;
 class StructType;
 class UnionType;
 class EnumType;
@@ -45,6 +46,46 @@ struct CCOpts
 {
   unsigned OptLevel;
   std::vector<std::string> IncludeDirs;
+  // Target CPU (e.g. "skylake") and features (e.g. "+avx2", "-avx512f"),
+  // used by both clang and the JIT. Empty values mean the host ones.
+  std::string CPU;
+  std::vector<std::string> Features;
+  // Allow floating point optimizations that break IEEE semantics, like
+  // -ffast-math
+  bool FastMath = false;
+  // Enable the loop and SLP vectorizers, and loop unrolling (only from -O2)
+  bool Vectorize = true;
+  bool Unroll = true;
+  // Generate a wrapper per function, which directly calls it (or its
+  // resolved address for external functions), instead of one per function
+  // type. This allows LLVM to inline small functions into their wrappers, at
+  // the cost of a longer compilation.
+  bool DirectTrampolines = false;
+  // Compile compilation units at -O0, and count the calls of each function
+  // through its own wrapper. Once a function has been called
+  // TierUpThreshold times, it is recompiled at -O3 for the target CPU in a
+  // background thread, and subsequent calls through NativeFunc objects use
+  // the optimized code. Function pointers (NativeFunc::getFuncCodePtr) keep
+  // pointing to the -O0 version. Pointers returned by NativeFunc::as use the
+  // code current at the time they are returned, and their calls aren't
+  // counted. This replaces DirectTrampolines. A TierUpThreshold of 0 is
+  // handled as 1.
+  bool TieredCompilation = false;
+  unsigned TierUpThreshold = 1000;
+  // Instrument compilation units to count the executions of their functions
+  // and branches. The collected profile can be used to recompile them (see
+  // CompilationUnit::optimizeWithProfile). Like with TieredCompilation,
+  // every function gets its own wrapper (instead of DirectTrampolines).
+  bool ProfileInstrument = false;
+  // Enable OpenMP directives (e.g. "#pragma omp parallel for"). The OpenMP
+  // runtime (libomp) is loaded by the first compilation, unless it is
+  // already present in the process (e.g. through DFFI::dlopen).
+  bool OpenMP = false;
+  // Keep a copy of the IR of compilation units, so that their functions can
+  // be reoptimized by DFFI::specialize. Without it, specialized functions
+  // call the original ones with the bound arguments. Implied by
+  // TieredCompilation and ProfileInstrument.
+  bool KeepIR = false;
 };
 
 struct DFFI;
@@ -81,6 +122,17 @@ public:
   std::vector<std::string> getTypes() const;
   std::vector<std::string> getFunctions() const;
 
+  // Returns the functions of an instrumented compilation unit (see
+  // CCOpts::ProfileInstrument) which have been called, with their number of
+  // calls, from the most called one.
+  std::vector<std::pair<std::string, uint64_t>> getHotFunctions() const;
+
+  // Recompiles an instrumented compilation unit with the profile collected
+  // so far, in memory. Functions obtained from this compilation unit
+  // (before or after this call) then use the new code through
+  // NativeFunc::call, while sharing the same global variables.
+  bool optimizeWithProfile(std::string& Err);
+
 private:
   // Owned by DFFIImpl
   details::CUImpl* Impl_;
@@ -104,8 +156,21 @@ struct DFFI_API DFFI
   }
   PointerType const* getPointerType(Type const* Ty);
   ArrayType const* getArrayType(Type const* Ty, uint64_t NElements);
+  VectorType const* getVectorType(BasicType const* Ty, unsigned NElements);
+  // Returns null for variadic functions without any fixed parameter, which C
+  // doesn't allow.
+  FunctionType const* getFunctionType(Type const* RetTy, std::vector<QualType> const& ParamsTy, CallingConv CC = CC_C, bool VarArgs = false);
 
   NativeFunc getFunction(FunctionType const* FTy, void* FPtr);
+  NativeClosure getClosure(FunctionType const* FTy, NativeClosure::HandlerTy Handler, void* Ctx);
+
+  // Creates a version of F where the arguments at the given indexes are
+  // bound to the values pointed by Args. The remaining parameters are kept in
+  // order. If F has been compiled by this object with CCOpts::KeepIR, its IR
+  // is reoptimized with these constants. Otherwise, F is called with the
+  // bound arguments.
+  // Returns an invalid function and sets Err on failure.
+  NativeFunc specialize(NativeFunc const& F, std::map<unsigned, void const*> const& Args, std::string& Err);
 
   static bool dlopen(const char* Path, std::string* Err = nullptr);
 
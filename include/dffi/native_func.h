@@ -15,32 +15,73 @@
 #ifndef DFFI_NATIVE_FUNC_H
 #define DFFI_NATIVE_FUNC_H
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <dffi/exports.h>
 
 namespace dffi {
 
 class FunctionType;
 class Type;
+struct QualType;
 
 namespace details {
 struct DFFIImpl;
 } // details
 
+struct ArgsFrame;
+
 struct DFFI_API NativeFunc
 {
   typedef void(*TrampPtrTy)(void*, void*, void**);
+  typedef void(*FrameTrampPtrTy)(void*, void*, void*);
+  typedef void(*BatchTrampPtrTy)(void*, void*, size_t, void* const*, size_t);
 
   NativeFunc();
 
-  NativeFunc(NativeFunc&&) = default;
-  NativeFunc(NativeFunc const&) = default;
+  NativeFunc(NativeFunc const& O);
+  NativeFunc(NativeFunc&& O):
+    NativeFunc(static_cast<NativeFunc const&>(O))
+  { }
 
   void call(void* Ret, void** Args) const;
   void call(void** Args) const;
   void call() const;
 
+  // Calls the function with its arguments packed in Frame (see
+  // FunctionType::getFrameLayout). The frame trampoline of the function type
+  // is compiled on first use. Like call, this can be used by several threads
+  // at once.
+  void callFrame(void* Ret, void* Frame) const;
+  void callFrame(void* Ret, ArgsFrame const& Frame) const;
+
+  // Returns a new zero-initialized arguments frame for this function.
+  ArgsFrame newFrame() const;
+
+  // Calls the function N times, with the arguments packed in the frames
+  // ArgFrames[0..N). The I-th returned value is written at
+  // Rets+I*RetStride, and Rets can be null for void functions. The loop is
+  // JIT-compiled for the function type on first use.
+  void callBatch(void* Rets, size_t RetStride, void* const* ArgFrames, size_t N) const;
+
   TrampPtrTy getTrampPtr() const { return TrampFuncPtr_; }
+  FrameTrampPtrTy getFrameTrampPtr() const;
+  BatchTrampPtrTy getBatchTrampPtr() const;
   void* getFuncCodePtr() const { return FuncCodePtr_; }
+  // Returns the code currently used to call this function, which can be an
+  // optimized version of getFuncCodePtr() with tiered compilation or
+  // profile-guided reoptimization.
+  void* getCurrentCodePtr() const { return CodeSlot_ ? CodeSlot_->load(std::memory_order_acquire) : FuncCodePtr_; }
+  // Returns the slot holding the current code of the function, or null if
+  // it always uses getFuncCodePtr().
+  std::atomic<void*> const* getCodeSlot() const { return CodeSlot_; }
   // TODO!
   //size_t getFuncCodeSize() const;
 
@@ -49,14 +90,122 @@ struct DFFI_API NativeFunc
   dffi::FunctionType const* getType() const { return FTy_; }
   dffi::Type const* getReturnType() const; 
 
+  // Returns a pointer to this function with the C++ signature Sig (e.g.
+  // int(int,float)), or null if Sig doesn't match its type. Basic types are
+  // checked with BasicType::getKind. Structures/unions are only accepted
+  // through pointers, and checked by their layouts.
+  // The returned pointer is called without any marshalling, and points to
+  // the current code of the function (see getCurrentCodePtr).
+  template <class Sig>
+  Sig* as() const;
+
+  // Calls this function with the signature deduced from R and the argument
+  // types. The signature is checked on every call: use as() to check it
+  // once.
+  template <class R, class... Args>
+  R callAs(Args... As) const;
+
+  // Returns this variadic function, to be called with variadic arguments of
+  // types VarArgsTys after the fixed ones (see
+  // FunctionType::getVarArgsCallType). The trampoline of each call type is
+  // compiled once, and cached for the next calls with the same types.
+  NativeFunc getVarArgsFunction(std::vector<QualType> const& VarArgsTys) const;
+
+  // Returns a new function whose arguments at the given indexes are bound to
+  // the pointed constant values (see DFFI::specialize).
+  NativeFunc specialize(std::map<unsigned, void const*> const& Args, std::string& Err) const;
+
 protected:
   friend class details::DFFIImpl;
 
-  NativeFunc(TrampPtrTy Ptr, void* CodePtr, dffi::FunctionType const* FTy);
+  NativeFunc(TrampPtrTy Ptr, void* CodePtr, dffi::FunctionType const* FTy, std::atomic<void*> const* CodeSlot = nullptr);
 
 private:
   TrampPtrTy TrampFuncPtr_;
+  // Lazily resolved, possibly by concurrent calls
+  mutable std::atomic<FrameTrampPtrTy> FrameTrampFuncPtr_;
+  mutable std::atomic<BatchTrampPtrTy> BatchTrampFuncPtr_;
   void* FuncCodePtr_;
+  // Current code of a tiered function (see details::TieredFunc), or null
+  std::atomic<void*> const* CodeSlot_;
+  dffi::FunctionType const* FTy_;
+};
+
+// Aligned buffer holding the packed arguments of a function type, to be used
+// with NativeFunc::callFrame. A frame can be reused for several calls: only
+// the arguments that change between calls need to be set again.
+struct DFFI_API ArgsFrame
+{
+  ArgsFrame();
+  ArgsFrame(dffi::FunctionType const* FTy);
+
+  ArgsFrame(ArgsFrame&&) = default;
+  ArgsFrame& operator=(ArgsFrame&&) = default;
+
+  // Copies the value pointed by Ptr as the argument Idx
+  void set(size_t Idx, void const* Ptr);
+
+  template <class T>
+  void set(size_t Idx, T const& V)
+  {
+    assert(sizeof(T) == getArgSize(Idx) && "invalid argument size!");
+    memcpy(getArgPtr(Idx), &V, sizeof(T));
+  }
+
+  void* getArgPtr(size_t Idx) const
+  {
+    assert(Idx < Offsets_.size() && "argument index out of range!");
+    return Data_ + Offsets_[Idx];
+  }
+  size_t getArgSize(size_t Idx) const;
+
+  void* data() const { return Data_; }
+  size_t size() const { return Size_; }
+  size_t getNumArgs() const { return Offsets_.size(); }
+
+  dffi::FunctionType const* getType() const { return FTy_; }
+
+private:
+  dffi::FunctionType const* FTy_;
+  std::unique_ptr<char[]> Buf_;
+  char* Data_;
+  size_t Size_;
+  std::vector<uint64_t> Offsets_;
+};
+
+// C function pointer which forwards its calls to a native handler. Arguments
+// are given to the handler as an array of pointers, and the return value must
+// be written to the Ret pointer (which is null for void functions), like with
+// NativeFunc::call. The underlying code is released back to the DFFI closure
+// pool when this object is destroyed, and thus must not outlive the DFFI
+// object that created it.
+struct DFFI_API NativeClosure
+{
+  typedef void(*HandlerTy)(void* Ctx, void* Ret, void** Args);
+
+  NativeClosure();
+  ~NativeClosure();
+
+  NativeClosure(NativeClosure&& O);
+  NativeClosure& operator=(NativeClosure&& O);
+  NativeClosure(NativeClosure const&) = delete;
+  NativeClosure& operator=(NativeClosure const&) = delete;
+
+  void* getCodePtr() const { return CodePtr_; }
+  dffi::FunctionType const* getType() const { return FTy_; }
+
+  operator bool() const { return CodePtr_ != nullptr; }
+
+protected:
+  friend class details::DFFIImpl;
+
+  NativeClosure(void* CodePtr, void* Slot, dffi::FunctionType const* FTy);
+
+private:
+  void release();
+
+  void* CodePtr_;
+  void* Slot_;
   dffi::FunctionType const* FTy_;
 };
 
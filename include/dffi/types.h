@@ -20,6 +20,8 @@
 #include <vector>
 #include <cstdint>
 #include <cassert>
+#include <initializer_list>
+#include <type_traits>
 
 #include <dffi/casting.h>
 #include <dffi/cc.h>
@@ -40,6 +42,7 @@ struct DFFI_API Type
     TY_Pointer,
     TY_Function,
     TY_Array,
+    TY_Vector,
     TY_CanOpaqueType,
     TY_Composite,
     TY_Struct,
@@ -100,6 +103,9 @@ public:
   template <class T>
   static constexpr BasicKind getKind() { return getKindDefault<T>(); }
 
+  // Returns the basic type of kind K from the DFFI object of Ty
+  static BasicType const* get(Type const* Ty, BasicKind K);
+
 protected:
   BasicType(details::DFFIImpl& Dffi, BasicKind BKind);
 
@@ -142,14 +148,14 @@ struct KindDefault;
     static constexpr BasicType::BasicKind Kind = K;\
   };
 
-BASICTY_GETKIND_DEFAULT(1, false, BasicType::Int8)
-BASICTY_GETKIND_DEFAULT(1, true, BasicType::UInt8)
-BASICTY_GETKIND_DEFAULT(2, false, BasicType::Int16)
-BASICTY_GETKIND_DEFAULT(2, true, BasicType::UInt16)
-BASICTY_GETKIND_DEFAULT(4, false, BasicType::Int32)
-BASICTY_GETKIND_DEFAULT(4, true, BasicType::UInt32)
-BASICTY_GETKIND_DEFAULT(8, false, BasicType::Int64)
-BASICTY_GETKIND_DEFAULT(8, true, BasicType::UInt64)
+BASICTY_GETKIND_DEFAULT(1, true, BasicType::Int8)
+BASICTY_GETKIND_DEFAULT(1, false, BasicType::UInt8)
+BASICTY_GETKIND_DEFAULT(2, true, BasicType::Int16)
+BASICTY_GETKIND_DEFAULT(2, false, BasicType::UInt16)
+BASICTY_GETKIND_DEFAULT(4, true, BasicType::Int32)
+BASICTY_GETKIND_DEFAULT(4, false, BasicType::UInt32)
+BASICTY_GETKIND_DEFAULT(8, true, BasicType::Int64)
+BASICTY_GETKIND_DEFAULT(8, false, BasicType::UInt64)
 
 } // details
 
@@ -270,14 +276,40 @@ public:
   bool hasVarArgs() const { return Flags_.D.VarArgs; }
   CallingConv getCC() const { return (CallingConv)Flags_.D.CC; }
 
+  // Number of parameters before the ellipsis of a variadic function. The
+  // parameters after them are the variadic arguments of a call shape (see
+  // getVarArgsCallType).
+  size_t getNumFixedParams() const { return NFixedParams_; }
+
+  // Returns the type used to call this variadic function with variadic
+  // arguments of types VarArgsTys. These types are promoted as in C (float
+  // to double, integers smaller than int to int), so that every call with
+  // the same promoted types gets the same type, and thus the same
+  // trampoline.
+  FunctionType const* getVarArgsCallType(ParamsVecTy const& VarArgsTys) const;
+
   NativeFunc getFunction(void* Ptr) const;
+  NativeClosure getClosure(NativeClosure::HandlerTy Handler, void* Ctx) const;
+
+  // Layout of the packed arguments frame used by NativeFunc::callFrame. Each
+  // argument is stored at its offset with its natural alignment, and the
+  // frame size is rounded up to the frame alignment, so that frames can be
+  // stored contiguously.
+  struct FrameLayout
+  {
+    std::vector<uint64_t> Offsets;
+    uint64_t Size;
+    unsigned Align;
+  };
+  FrameLayout getFrameLayout() const;
 
 protected:
-  FunctionType(details::DFFIImpl& Dffi, QualType RetTy, ParamsVecTy ParamsTy, CallingConv CC);
+  FunctionType(details::DFFIImpl& Dffi, QualType RetTy, ParamsVecTy ParamsTy, CallingConv CC, bool VarArgs, size_t NFixedParams);
 
 private:
   QualType RetTy_;
   ParamsVecTy ParamsTy_;
+  uint32_t NFixedParams_;
   union {
     struct {
       uint8_t CC: 7;
@@ -299,6 +331,7 @@ public:
   Type const* getElementType() const { return Ty_; }
   uint64_t getNumElements() const { return NElements_; }
   uint64_t getSize() const override { return Ty_->getSize()*NElements_; }
+  unsigned getAlign() const override { return Ty_->getAlign(); }
 
 protected:
   ArrayType(details::DFFIImpl& Dffi, QualType Ty, uint64_t NElements);
@@ -307,6 +340,140 @@ protected:
   uint64_t NElements_;
 };
 
+// SIMD vectors, like float __attribute__((vector_size(16))) or __m256d. As
+// with clang, the size of a vector is rounded up to the next power of two,
+// and vectors are aligned on their size.
+class DFFI_API VectorType: public Type
+{
+  friend class details::DFFICtx;
+
+public:
+  static bool classof(Type const* T) {
+    return T->getKind() == TY_Vector;
+  }
+
+  BasicType const* getElementType() const { return Ty_; }
+  unsigned getNumElements() const { return NElements_; }
+  uint64_t getSize() const override;
+  unsigned getAlign() const override { return getSize(); }
+
+protected:
+  VectorType(details::DFFIImpl& Dffi, BasicType const* Ty, unsigned NElements);
+
+  BasicType const* Ty_;
+  unsigned NElements_;
+};
+
+// Typed calls
+//
+
+namespace details {
+
+// Checks that a C++ type is ABI-compatible with a DFFI type
+template <class T, class Enable = void>
+struct CxxTypeMatcher;
+
+template <>
+struct CxxTypeMatcher<void>
+{
+  static bool match(Type const* Ty) { return Ty == nullptr; }
+  // void* matches any pointer
+  static bool matchPointee(Type const*) { return true; }
+};
+
+template <class T>
+struct CxxTypeMatcher<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+  static bool match(Type const* Ty)
+  {
+    if (auto* BTy = dyn_cast_or_null<BasicType>(Ty)) {
+      return BTy->getBasicKind() == BasicType::getKind<T>();
+    }
+    // C enums are integers
+    return std::is_integral<T>::value && Ty && Ty->getKind() == Type::TY_Enum && Ty->getSize() == sizeof(T);
+  }
+  static bool matchPointee(Type const* Ty) { return match(Ty); }
+};
+
+template <class T>
+struct CxxTypeMatcher<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+  static bool match(Type const* Ty) { return CxxTypeMatcher<typename std::underlying_type<T>::type>::match(Ty); }
+  static bool matchPointee(Type const* Ty) { return match(Ty); }
+};
+
+// Structures and unions: only their layouts can be checked, which is enough
+// to access them through pointers. They are refused by value, as two
+// structures with the same layout can be passed differently (e.g.
+// struct { float a; int b; } and struct { double a; } with the SysV ABI).
+template <class T>
+struct CxxTypeMatcher<T, typename std::enable_if<std::is_class<T>::value || std::is_union<T>::value>::type>
+{
+  static bool match(Type const*) { return false; }
+  static bool matchPointee(Type const* Ty)
+  {
+    if (!Ty || !std::is_trivially_copyable<T>::value) {
+      return false;
+    }
+    const auto Kind = Ty->getKind();
+    return Kind > Type::TY_Composite && Kind < Type::TY_CompositeEnd &&
+      Ty->getSize() == sizeof(T) && Ty->getAlign() == alignof(T);
+  }
+};
+
+template <class T>
+struct CxxTypeMatcher<T*, void>
+{
+  static bool match(Type const* Ty)
+  {
+    auto* PTy = dyn_cast_or_null<PointerType>(Ty);
+    return PTy && CxxTypeMatcher<typename std::remove_cv<T>::type>::matchPointee(PTy->getPointee());
+  }
+  static bool matchPointee(Type const* Ty) { return match(Ty); }
+};
+
+template <class R, class... Args>
+struct CxxTypeMatcher<R(Args...), void>
+{
+  static bool match(Type const* Ty)
+  {
+    auto* FTy = dyn_cast_or_null<FunctionType>(Ty);
+    if (!FTy || FTy->getCC() != CC_C || FTy->hasVarArgs()) {
+      return false;
+    }
+    auto const& Params = FTy->getParams();
+    if (Params.size() != sizeof...(Args) || !CxxTypeMatcher<R>::match(FTy->getReturnType())) {
+      return false;
+    }
+    bool Ret = true;
+    size_t I = 0;
+    (void)std::initializer_list<int>{(Ret = Ret && CxxTypeMatcher<typename std::remove_cv<Args>::type>::match(Params[I++]), 0)...};
+    (void)I;
+    return Ret;
+  }
+  static bool matchPointee(Type const* Ty) { return match(Ty); }
+};
+
+} // details
+
+template <class Sig>
+Sig* NativeFunc::as() const
+{
+  static_assert(std::is_function<Sig>::value, "as() must be given a function signature (e.g. int(int,int))");
+  if (!FTy_ || !details::CxxTypeMatcher<Sig>::match(FTy_)) {
+    return nullptr;
+  }
+  return reinterpret_cast<Sig*>(getCurrentCodePtr());
+}
+
+template <class R, class... Args>
+R NativeFunc::callAs(Args... As) const
+{
+  auto* F = as<R(Args...)>();
+  assert(F && "C++ signature doesn't match the function type!");
+  return F(As...);
+}
+
 } // dffi
 
 namespace std {
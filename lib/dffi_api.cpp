@@ -58,11 +58,31 @@ ArrayType const* DFFI::getArrayType(Type const* Ty, uint64_t NElements)
   return Impl_->getArrayType(Ty, NElements);
 }
 
+VectorType const* DFFI::getVectorType(BasicType const* Ty, unsigned NElements)
+{
+  return Impl_->getVectorType(Ty, NElements);
+}
+
+FunctionType const* DFFI::getFunctionType(Type const* RetTy, std::vector<QualType> const& ParamsTy, CallingConv CC, bool VarArgs)
+{
+  return Impl_->getFunctionType(RetTy, ParamsTy, CC, VarArgs);
+}
+
 NativeFunc DFFI::getFunction(FunctionType const* FTy, void* FPtr)
 {
   return Impl_->getFunction(FTy, FPtr);
 }
 
+NativeFunc DFFI::specialize(NativeFunc const& F, std::map<unsigned, void const*> const& Args, std::string& Err)
+{
+  return Impl_->specialize(F, Args, Err);
+}
+
+NativeClosure DFFI::getClosure(FunctionType const* FTy, NativeClosure::HandlerTy Handler, void* Ctx)
+{
+  return Impl_->getClosure(FTy, Handler, Ctx);
+}
+
 void DFFI::initialize()
 {
   llvm::InitializeNativeTarget();
@@ -261,6 +281,18 @@ NativeFunc CompilationUnit::getFunction(const char* Name)
   return Impl_->getFunction(Name);
 }
 
+std::vector<std::pair<std::string, uint64_t>> CompilationUnit::getHotFunctions() const
+{
+  assert(isValid());
+  return Impl_->getHotFunctions();
+}
+
+bool CompilationUnit::optimizeWithProfile(std::string& Err)
+{
+  assert(isValid());
+  return Impl_->DFFI_.optimizeWithProfile(*Impl_, Err);
+}
+
 bool CompilationUnit::isValid() const
 {
   return (bool)Impl_;
@@ -271,21 +303,36 @@ bool CompilationUnit::isValid() const
 
 NativeFunc::NativeFunc():
   TrampFuncPtr_(nullptr),
+  FrameTrampFuncPtr_(nullptr),
+  BatchTrampFuncPtr_(nullptr),
   FuncCodePtr_(nullptr),
+  CodeSlot_(nullptr),
   FTy_(nullptr)
 { }
 
 dffi::Type const* NativeFunc::getReturnType() const
 { return getType()->getReturnType(); }
 
-NativeFunc::NativeFunc(TrampPtrTy Ptr, void* CodePtr, dffi::FunctionType const* FTy):
+NativeFunc::NativeFunc(TrampPtrTy Ptr, void* CodePtr, dffi::FunctionType const* FTy, std::atomic<void*> const* CodeSlot):
   TrampFuncPtr_(Ptr),
+  FrameTrampFuncPtr_(nullptr),
+  BatchTrampFuncPtr_(nullptr),
   FuncCodePtr_(CodePtr),
+  CodeSlot_(CodeSlot),
   FTy_(FTy)
 {
   assert(!((Ptr == nullptr) ^ (FTy == nullptr)) && "function wrapper pointer without function type (or the other way around)!");
 }
 
+NativeFunc::NativeFunc(NativeFunc const& O):
+  TrampFuncPtr_(O.TrampFuncPtr_),
+  FrameTrampFuncPtr_(O.FrameTrampFuncPtr_.load(std::memory_order_acquire)),
+  BatchTrampFuncPtr_(O.BatchTrampFuncPtr_.load(std::memory_order_acquire)),
+  FuncCodePtr_(O.FuncCodePtr_),
+  CodeSlot_(O.CodeSlot_),
+  FTy_(O.FTy_)
+{ }
+
 void NativeFunc::call(void* Ret, void** Args) const
 {
   TrampFuncPtr_(FuncCodePtr_, Ret, Args);
@@ -301,11 +348,146 @@ void NativeFunc::call() const
   TrampFuncPtr_(FuncCodePtr_, nullptr, nullptr);
 }
 
+NativeFunc::FrameTrampPtrTy NativeFunc::getFrameTrampPtr() const
+{
+  auto Ptr = FrameTrampFuncPtr_.load(std::memory_order_acquire);
+  if (!Ptr) {
+    // The DFFI object returns the same trampoline to concurrent callers
+    Ptr = FTy_->getDFFI().getFrameTrampoline(FTy_);
+    FrameTrampFuncPtr_.store(Ptr, std::memory_order_release);
+  }
+  return Ptr;
+}
+
+void NativeFunc::callFrame(void* Ret, void* Frame) const
+{
+  getFrameTrampPtr()(getCurrentCodePtr(), Ret, Frame);
+}
+
+void NativeFunc::callFrame(void* Ret, ArgsFrame const& Frame) const
+{
+  assert(Frame.getType() == FTy_ && "frame of another function type!");
+  callFrame(Ret, Frame.data());
+}
+
+NativeFunc::BatchTrampPtrTy NativeFunc::getBatchTrampPtr() const
+{
+  auto Ptr = BatchTrampFuncPtr_.load(std::memory_order_acquire);
+  if (!Ptr) {
+    Ptr = FTy_->getDFFI().getBatchTrampoline(FTy_);
+    BatchTrampFuncPtr_.store(Ptr, std::memory_order_release);
+  }
+  return Ptr;
+}
+
+void NativeFunc::callBatch(void* Rets, size_t RetStride, void* const* ArgFrames, size_t N) const
+{
+  getBatchTrampPtr()(getCurrentCodePtr(), Rets, RetStride, ArgFrames, N);
+}
+
+ArgsFrame NativeFunc::newFrame() const
+{
+  return ArgsFrame{FTy_};
+}
+
 NativeFunc::operator bool() const
 {
   return TrampFuncPtr_ != nullptr;
 }
 
+NativeFunc NativeFunc::getVarArgsFunction(std::vector<QualType> const& VarArgsTys) const
+{
+  return FTy_->getDFFI().getVarArgsFunction(*this, VarArgsTys);
+}
+
+NativeFunc NativeFunc::specialize(std::map<unsigned, void const*> const& Args, std::string& Err) const
+{
+  return FTy_->getDFFI().specialize(*this, Args, Err);
+}
+
+// ArgsFrame
+//
+
+ArgsFrame::ArgsFrame():
+  FTy_(nullptr),
+  Data_(nullptr),
+  Size_(0)
+{ }
+
+ArgsFrame::ArgsFrame(FunctionType const* FTy):
+  FTy_(FTy)
+{
+  auto Layout = FTy->getFrameLayout();
+  Size_ = Layout.Size;
+  Offsets_ = std::move(Layout.Offsets);
+  const uintptr_t Align = Layout.Align;
+  Buf_.reset(new char[Size_ + Align]);
+  Data_ = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(Buf_.get()) + Align - 1) & ~(Align - 1));
+  memset(Data_, 0, Size_);
+}
+
+size_t ArgsFrame::getArgSize(size_t Idx) const
+{
+  return FTy_->getParams()[Idx]->getSize();
+}
+
+void ArgsFrame::set(size_t Idx, void const* Ptr)
+{
+  memcpy(getArgPtr(Idx), Ptr, getArgSize(Idx));
+}
+
+// NativeClosure
+//
+
+NativeClosure::NativeClosure():
+  CodePtr_(nullptr),
+  Slot_(nullptr),
+  FTy_(nullptr)
+{ }
+
+NativeClosure::NativeClosure(void* CodePtr, void* Slot, dffi::FunctionType const* FTy):
+  CodePtr_(CodePtr),
+  Slot_(Slot),
+  FTy_(FTy)
+{ }
+
+NativeClosure::NativeClosure(NativeClosure&& O):
+  CodePtr_(O.CodePtr_),
+  Slot_(O.Slot_),
+  FTy_(O.FTy_)
+{
+  O.CodePtr_ = nullptr;
+  O.Slot_ = nullptr;
+  O.FTy_ = nullptr;
+}
+
+NativeClosure& NativeClosure::operator=(NativeClosure&& O)
+{
+  if (this != &O) {
+    release();
+    std::swap(CodePtr_, O.CodePtr_);
+    std::swap(Slot_, O.Slot_);
+    std::swap(FTy_, O.FTy_);
+  }
+  return *this;
+}
+
+NativeClosure::~NativeClosure()
+{
+  release();
+}
+
+void NativeClosure::release()
+{
+  if (!CodePtr_) {
+    return;
+  }
+  FTy_->getDFFI().releaseClosure(FTy_, CodePtr_, Slot_);
+  CodePtr_ = nullptr;
+  Slot_ = nullptr;
+  FTy_ = nullptr;
+}
+
 const char* CCToClangAttribute(CallingConv CC)
 {
   switch (CC) {
@@ -27,14 +27,20 @@
 #include <clang/Frontend/Utils.h>
 #include <clang/FrontendTool/Utils.h>
 #include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/Option/Arg.h>
 #include <llvm/Option/ArgList.h>
 #include <llvm/Support/Compiler.h>
 #include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MutexGuard.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/Program.h>
 #include <llvm/Support/Signals.h>
@@ -42,6 +48,8 @@
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 #include <dffi/dffi.h>
 #include <dffi/types.h>
@@ -178,6 +186,37 @@ void InitHeaderSearchFlags(std::string const& TripleStr,
   }
 }
 
+bool loadOpenMPRuntime(std::string& Err)
+{
+  // The runtime is loaded once and for all, and can already be part of the
+  // process.
+  static const std::string LoadErr = []() -> std::string {
+    if (sys::DynamicLibrary::SearchForAddressOfSymbol("__kmpc_fork_call")) {
+      return {};
+    }
+    const char* Runtimes[] = {
+#ifdef DFFI_OPENMP_RUNTIME
+      DFFI_OPENMP_RUNTIME,
+#endif
+      "libomp.so", "libomp.dylib", "libiomp5.so", "libiomp5md.dll"
+    };
+    std::string Ret = "unable to load the OpenMP runtime:";
+    for (const char* R: Runtimes) {
+      std::string Err;
+      if (!sys::DynamicLibrary::LoadLibraryPermanently(R, &Err)) {
+        return {};
+      }
+      Ret += "\n" + Err;
+    }
+    return Ret;
+  }();
+  if (!LoadErr.empty()) {
+    Err = LoadErr;
+    return false;
+  }
+  return true;
+}
+
 std::string getWrapperName(size_t Idx)
 {
   return std::string{WrapperPrefix} + std::to_string(Idx);
@@ -185,6 +224,19 @@ std::string getWrapperName(size_t Idx)
 
 } // anonymous
 
+llvm::TargetOptions getTargetOptions(CCOpts const& Opts)
+{
+  llvm::TargetOptions Ret;
+  if (Opts.FastMath) {
+    Ret.UnsafeFPMath = true;
+    Ret.NoInfsFPMath = true;
+    Ret.NoNaNsFPMath = true;
+    Ret.NoSignedZerosFPMath = true;
+    Ret.AllowFPOpFusion = FPOpFusion::Fast;
+  }
+  return Ret;
+}
+
 DFFIImpl::DFFIImpl(CCOpts const& Opts):
     Clang_(new CompilerInstance()),
     DiagID_(new DiagnosticIDs()),
@@ -205,8 +257,24 @@ DFFIImpl::DFFIImpl(CCOpts const& Opts):
   auto& CI = Clang_->getInvocation();
 
 
+  // An empty CPU or feature set means the host one. They are resolved here,
+  // so that clang and the JIT use the same ones.
+  if (Opts_.CPU.empty()) {
+    Opts_.CPU = sys::getHostCPUName();
+  }
+  if (Opts_.Features.empty()) {
+    StringMap<bool> HostFeatures;
+    if (sys::getHostCPUFeatures(HostFeatures)) {
+      for (auto const& Feat: HostFeatures) {
+        Opts_.Features.emplace_back((Feat.second ? "+" : "-") + Feat.first().str());
+      }
+    }
+  }
+
   auto& TO = CI.getTargetOpts();
   TO.Triple = llvm::sys::getDefaultTargetTriple();
+  TO.CPU = Opts_.CPU;
+  TO.FeaturesAsWritten = Opts_.Features;
   // We create it by hand to have a minimal user-friendly API!
   // From Juan's code!
   auto& CGO = CI.getCodeGenOpts();
@@ -217,6 +285,17 @@ DFFIImpl::DFFIImpl(CCOpts const& Opts):
   CGO.ThreadModel = "posix";
   // We use debug info for type recognition!
   CGO.setDebugInfo(codegenoptions::FullDebugInfo);
+  // Like the clang driver, vectorizers are only enabled from -O2
+  CGO.VectorizeLoop = Opts.Vectorize && Opts.OptLevel >= 2;
+  CGO.VectorizeSLP = Opts.Vectorize && Opts.OptLevel >= 2;
+  CGO.UnrollLoops = Opts.Unroll && Opts.OptLevel >= 2;
+  if (Opts.FastMath) {
+    CGO.UnsafeFPMath = true;
+    CGO.NoInfsFPMath = true;
+    CGO.NoNaNsFPMath = true;
+    CGO.NoSignedZeros = true;
+    CGO.LessPreciseFPMAD = true;
+  }
 
   CI.getDiagnosticOpts().ShowCarets = false;
 
@@ -237,6 +316,8 @@ DFFIImpl::DFFIImpl(CCOpts const& Opts):
   CI.getLangOpts()->MicrosoftExt = IsWinMSVC;
   CI.getLangOpts()->AsmBlocks = IsWinMSVC;
   CI.getLangOpts()->DeclSpecKeyword = IsWinMSVC;
+  CI.getLangOpts()->FastMath = Opts.FastMath;
+  CI.getLangOpts()->FiniteMathOnly = Opts.FastMath;
   CI.getLangOpts()->MSBitfields = true;
   CI.getLangOpts()->EmitAllDecls = true;
 
@@ -245,6 +326,8 @@ DFFIImpl::DFFIImpl(CCOpts const& Opts):
   CI.getLangOpts()->GNUKeywords = true;
   CI.getLangOpts()->GNUAsm = true;
 
+  CI.getLangOpts()->OpenMP = Opts.OpenMP;
+
   CI.getFrontendOpts().ProgramAction = frontend::EmitLLVMOnly;
 
   auto& HSO = CI.getHeaderSearchOpts();
@@ -271,13 +354,19 @@ DFFIImpl::DFFIImpl(CCOpts const& Opts):
     .setErrorStr(&Error)
     .setOptLevel(CodeGenOpt::Default)
     .setCodeModel(CodeModel::Small)
-    .setRelocationModel(Reloc::PIC_);
+    .setRelocationModel(Reloc::PIC_)
+    .setMCPU(Opts_.CPU)
+    .setMAttrs(Opts_.Features)
+    .setTargetOptions(getTargetOptions(Opts_));
 
-  SmallVector<std::string, 1> Attrs;
-  // TODO: get the target machine from clang?
   EE_.reset(EB.create());
   if (!EE_) {
     errs() << "error creating jit: " << Error << "\n";
+    return;
+  }
+
+  if (Opts.TieredCompilation) {
+    TierWorker_.reset(new TierUpWorker{*this});
   }
 }
 
@@ -367,7 +456,10 @@ bool isWrapperFunction(StringRef const Name)
 }
 
 DFFIImpl::~DFFIImpl()
-{ }
+{
+  // Wait for the current recompilation (if any) to finish
+  TierWorker_.reset();
+}
 
 void DFFIImpl::genFuncTypeWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy)
 {
@@ -377,46 +469,161 @@ void DFFIImpl::genFuncTypeWrapper(TypePrinter& P, std::stringstream& ss, Functio
     return;
   }
 
-  ss << "void " << getWrapperName(TyIdx) << "(";
-  auto RetTy = FTy->getReturnType();
-  ss << P.print_def(getPointerType(FTy), TypePrinter::Full, "__FPtr") << ",";
-  ss << P.print_def(getPointerType(RetTy), TypePrinter::Full, "__Ret") << ",";
-  ss << "void** __Args";
+  genWrapper(P, ss, FTy, getWrapperName(TyIdx), "(__FPtr)");
+}
+
+std::string DFFIImpl::genWrapperArgs(TypePrinter& P, FunctionType const* FTy, FunctionType::FrameLayout const* Frame)
+{
+  // Arguments are either given as an array of pointers, or packed in a frame
+  // at the offsets of its layout.
   std::stringstream Impl;
   size_t Idx = 0;
   auto& Params = FTy->getParams();
   for (QualType ATy: Params) {
-    Impl << "*((" << P.print_def(getPointerType(ATy), TypePrinter::Full) << ")" << "__Args[" << Idx << "]" << ")";
+    Impl << "*((" << P.print_def(getPointerType(ATy), TypePrinter::Full) << ")";
+    if (Frame) {
+      Impl << "(__Frame+" << Frame->Offsets[Idx] << "))";
+    }
+    else {
+      Impl << "__Args[" << Idx << "]" << ")";
+    }
     if (Idx < Params.size()-1) {
       Impl << ",";
     }
     ++Idx;
   }
+  return Impl.str();
+}
+
+void DFFIImpl::genWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy, StringRef Name, StringRef Callee, FunctionType::FrameLayout const* Frame)
+{
+  ss << "void " << Name.str() << "(";
+  auto RetTy = FTy->getReturnType();
+  ss << P.print_def(getPointerType(FTy), TypePrinter::Full, "__FPtr") << ",";
+  ss << P.print_def(getPointerType(RetTy), TypePrinter::Full, "__Ret") << ",";
+  ss << (Frame ? "char* __Frame" : "void** __Args");
   ss << ") {\n  ";
   if (RetTy) {
     ss << "*__Ret = ";
   }
-  ss << "(__FPtr)(" << Impl.str() << ");\n";
+  ss << Callee.str() << "(" << genWrapperArgs(P, FTy, Frame) << ");\n";
   ss << "}\n";
 }
 
+void DFFIImpl::genBatchWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy, StringRef Name)
+{
+  // Calls the function for each frame, and stores the returned values
+  // RetStride bytes apart.
+  const auto Layout = FTy->getFrameLayout();
+  auto RetTy = FTy->getReturnType();
+  ss << "void " << Name.str() << "(";
+  ss << P.print_def(getPointerType(FTy), TypePrinter::Full, "__FPtr") << ",";
+  ss << "char* __Rets, uintptr_t __RetStride, char* const* __Frames, uintptr_t __N) {\n";
+  ss << "  for (uintptr_t __I = 0; __I < __N; ++__I) {\n";
+  ss << "    char* __Frame = __Frames[__I];\n    ";
+  if (RetTy) {
+    ss << "*((" << P.print_def(getPointerType(RetTy), TypePrinter::Full) << ")(__Rets+__I*__RetStride)) = ";
+  }
+  ss << "(__FPtr)(" << genWrapperArgs(P, FTy, &Layout) << ");\n";
+  ss << "  }\n";
+  ss << "}\n";
+}
+
+void DFFIImpl::linkDirectWrappers(CUImpl& CU, llvm::Module& M)
+{
+  // Each function gets its own wrapper which calls it directly. Functions
+  // defined in M are called through a placeholder declaration, which is
+  // replaced by the real function once the wrappers are linked in M (this
+  // also works for static functions). External functions are called through
+  // their resolved address.
+  TypePrinter P;
+  std::stringstream ss;
+  SmallVector<std::pair<std::string, Function*>, 16> Targets;
+  const std::string Prefix = "__dffi_direct_" + std::to_string(CUs_.size()) + "_";
+  size_t Idx = 0;
+  for (auto const& It: CU.FuncTys_) {
+    auto* FTy = It.second;
+    const std::string WName = Prefix + std::to_string(Idx++);
+    Function* F = M.getFunction(It.getKey());
+    if (F && !F->isDeclaration()) {
+      const std::string TName = WName + "_target";
+      ss << P.print_def(FTy, TypePrinter::Full, TName.c_str()) << ";\n";
+      genWrapper(P, ss, FTy, WName, TName);
+      Targets.emplace_back(TName, F);
+    }
+    else {
+      void* Ptr = sys::DynamicLibrary::SearchForAddressOfSymbol(It.getKey());
+      if (!Ptr) {
+        continue;
+      }
+      std::stringstream Callee;
+      Callee << "((" << P.print_def(getPointerType(FTy), TypePrinter::Full) << ")0x" << std::hex << (uintptr_t)Ptr << std::dec << "ULL)";
+      genWrapper(P, ss, FTy, WName, Callee.str());
+    }
+    CU.DirectWrappers_[It.getKey()] = WName;
+  }
+  if (CU.DirectWrappers_.empty()) {
+    return;
+  }
+
+  std::string WCode = "#include <stdint.h>\n\n";
+  WCode += P.getDecls() + "\n" + ss.str();
+  std::string Err;
+  auto WM = compile_llvm(WCode, "/__dffi_private/direct_" + std::to_string(CUIdx_++) + ".c", Err);
+  if (!WM) {
+    errs() << WCode;
+    errs() << Err;
+    llvm::report_fatal_error("unable to compile direct wrappers!");
+  }
+  llvm::StripDebugInfo(*WM);
+  if (Linker::linkModules(M, std::move(WM))) {
+    llvm::report_fatal_error("unable to link direct wrappers!");
+  }
+
+  SmallVector<GlobalValue*, 16> Used;
+  for (auto const& T: Targets) {
+    Function* Decl = M.getFunction(T.first);
+    if (!Decl) {
+      continue;
+    }
+    Decl->replaceAllUsesWith(ConstantExpr::getBitCast(T.second, Decl->getType()));
+    Decl->eraseFromParent();
+    // Keep the original functions, even if they have been inlined in every
+    // wrapper, as they can still be called through their addresses.
+    Used.push_back(T.second);
+  }
+  appendToUsed(M, Used);
+  optimizeModule(M);
+}
+
 CUImpl* DFFIImpl::compile(StringRef const Code, StringRef CUName, bool IncludeDefs, std::string& Err)
 {
   std::unique_ptr<llvm::Module> M;
   std::unique_ptr<CUImpl> CU(new CUImpl{*this});
 
+  if (Opts_.OpenMP && !loadOpenMPRuntime(Err)) {
+    return nullptr;
+  }
+
   std::string AnonCUName;
   if (CUName.empty()) {
     AnonCUName = "/__dffi_private/anon_cu_" + std::to_string(CUIdx_++) + ".c";
     CUName = AnonCUName;
   }
 
+  // With tiered compilation, user code is first compiled at -O0 (wrappers
+  // are still compiled at the requested level).
+  auto& CGO = Clang_->getInvocation().getCodeGenOpts();
+  if (Opts_.TieredCompilation) {
+    CGO.OptimizationLevel = 0;
+  }
   if (IncludeDefs) {
     M = compile_llvm_with_decls(Code, CUName, CU->FuncAliases_, Err);
   }
   else {
     M = compile_llvm(Code, CUName, Err);
   }
+  CGO.OptimizationLevel = Opts_.OptLevel;
   if (!M) {
     return nullptr;
   }
@@ -470,7 +677,9 @@ CUImpl* DFFIImpl::compile(StringRef const Code, StringRef CUName, bool IncludeDe
       continue;
     if (F.doesNotReturn())
       continue;
-    if (F.isVarArg())
+    // Functions generated by clang (e.g. OpenMP outlined regions) aren't
+    // valid C identifiers.
+    if (F.getName().startswith("."))
       continue;
     auto* DFTy = CU->getFunctionType(F);
     if (!DFTy)
@@ -494,39 +703,86 @@ CUImpl* DFFIImpl::compile(StringRef const Code, StringRef CUName, bool IncludeDe
   // Strip debug info (we don't need them anymore)!
   llvm::StripDebugInfo(*pM);
 
+  // Keep a copy of the IR, so that functions can later be specialized (see
+  // DFFIImpl::specialize) or recompiled. Internal global variables are given
+  // unique external names, so that these copies can refer to them.
+  if (Opts_.KeepIR || Opts_.TieredCompilation || Opts_.ProfileInstrument) {
+    for (GlobalVariable& GV: pM->globals()) {
+      if (GV.hasLocalLinkage() && !GV.isDeclaration()) {
+        GV.setName("__dffi_cu" + std::to_string(CUs_.size()) + "_" + GV.getName());
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+      }
+    }
+    CU->IRModule_ = llvm::CloneModule(pM);
+  }
+
+  if (Opts_.TieredCompilation) {
+    // Hot functions are recompiled in a background thread, in their own
+    // LLVM context.
+    raw_string_ostream OS(CU->Bitcode_);
+    WriteBitcodeToFile(CU->IRModule_.get(), OS);
+    OS.flush();
+  }
+  else
+  if (Opts_.DirectTrampolines && !Opts_.ProfileInstrument) {
+    linkDirectWrappers(*CU, *pM);
+  }
+
+  if (Opts_.ProfileInstrument) {
+    instrumentModule(*CU, *pM);
+  }
+
   // Add the module to the EE
-  EE_->addModule(std::move(M));
-  EE_->generateCodeForModule(pM);
+  addModule(std::move(M));
+
+  if (Opts_.ProfileInstrument) {
+    CU->ProfCounters_ = (uint64_t*)getGlobalValueAddress("__dffi_prof_" + std::to_string(CUs_.size()));
+  }
+  if (Opts_.TieredCompilation || Opts_.ProfileInstrument) {
+    compileTieredWrappers(*CU);
+  }
 
+  compileWrappers(Printer, Wrappers.str());
+
+  // We don't need these anymore
+  CU->AnonTys_.clear();
+
+  auto* Ret = CU.get();
+  CUs_.emplace_back(std::move(CU));
+  return Ret;
+}
 
-  // Compile wrappers
+void DFFIImpl::compileWrappers(TypePrinter& Printer, std::string const& Wrappers)
+{
   std::string WCode = "#include <stdint.h>\n\n";
-  WCode += Printer.getDecls() + "\n" + Wrappers.str();
+  WCode += Printer.getDecls() + "\n" + Wrappers;
   std::stringstream ss;
   ss << "/__dffi_private/wrappers_" << CUIdx_++ << ".c";
   //errs() << WCode;
-  M = compile_llvm(WCode, ss.str(), Err);
+  std::string Err;
+  auto M = compile_llvm(WCode, ss.str(), Err);
   if (!M) {
     errs() << WCode;
     errs() << Err;
     llvm::report_fatal_error("unable to compile wrappers!");
   }
-  pM = M.get();
+  addModule(std::move(M));
+}
+
+void DFFIImpl::addModule(std::unique_ptr<Module> M)
+{
+  MutexGuard Lock(EE_->lock);
+  auto* pM = M.get();
   EE_->addModule(std::move(M));
   EE_->generateCodeForModule(pM);
-
-  // We don't need these anymore
-  CU->AnonTys_.clear();
-
-  auto* Ret = CU.get();
-  CUs_.emplace_back(std::move(CU));
-  return Ret;
 }
 
 void* DFFIImpl::getFunctionAddress(StringRef Name)
 {
   // TODO: chances that this is clearly sub optimal
   // TODO: use getAddressToGlobalIfAvailable?
+  // The EE can be concurrently modified by the tier-up thread
+  MutexGuard Lock(EE_->lock);
   Function* F = EE_->FindFunctionNamed(Name);
   if (!F || F->isDeclaration()) {
     return sys::DynamicLibrary::SearchForAddressOfSymbol(Name);
@@ -547,14 +803,185 @@ void* DFFIImpl::getFunctionAddress(StringRef Name)
 #endif
 }
 
+void* DFFIImpl::getGlobalValueAddress(StringRef Name)
+{
+  MutexGuard Lock(EE_->lock);
+  return (void*)EE_->getGlobalValueAddress(Name.str());
+}
+
 NativeFunc DFFIImpl::getFunction(FunctionType const* FTy, void* FPtr)
 {
-  std::string TName = getWrapperName(FuncTyWrappers_[FTy]);
+  auto It = FuncTyWrappers_.find(FTy);
+  if (It == FuncTyWrappers_.end()) {
+    // This function type hasn't been seen in any compilation unit (it has
+    // been created by getFunctionType). Compile its wrapper now.
+    TypePrinter Printer;
+    std::stringstream Wrapper;
+    genFuncTypeWrapper(Printer, Wrapper, FTy);
+    compileWrappers(Printer, Wrapper.str());
+    It = FuncTyWrappers_.find(FTy);
+  }
+  std::string TName = getWrapperName(It->second);
   auto TFPtr = (NativeFunc::TrampPtrTy)getFunctionAddress(TName);
   assert(TFPtr && "function type trampoline doesn't exist!");
   return {TFPtr, FPtr, FTy};
 }
 
+void DFFIImpl::compileClosures(FunctionType const* FTy, ClosurePool& Pool)
+{
+  // Number of closures compiled at once for a given function type
+  static constexpr size_t ChunkSize = 32;
+
+  const std::string Suffix = std::to_string(Pool.TyIdx) + "_" + std::to_string(Pool.NChunks++);
+  const std::string SlotsName = "__dffi_closure_slots_" + Suffix;
+  const std::string PtrsName = "__dffi_closure_ptrs_" + Suffix;
+
+  TypePrinter P;
+  std::stringstream Impl;
+  auto RetTy = FTy->getReturnType();
+  auto const& Params = FTy->getParams();
+  for (size_t I = 0; I < ChunkSize; ++I) {
+    std::stringstream Decl;
+    Decl << "(" << CCToClangAttribute(FTy->getCC()) << " __dffi_closure_" << Suffix << "_" << I << ")(";
+    if (Params.empty()) {
+      Decl << "void";
+    }
+    for (size_t A = 0; A < Params.size(); ++A) {
+      if (A > 0) {
+        Decl << ",";
+      }
+      const std::string AName = "__a" + std::to_string(A);
+      Decl << P.print_def(Params[A], TypePrinter::Full, AName.c_str());
+    }
+    Decl << ")";
+
+    const std::string Slot = SlotsName + "[" + std::to_string(I) + "]";
+    Impl << "static " << P.print_def(RetTy, TypePrinter::Full, Decl.str().c_str()) << " {\n";
+    if (Params.empty()) {
+      Impl << "  void** __Args = 0;\n";
+    }
+    else {
+      Impl << "  void* __Args[] = {";
+      for (size_t A = 0; A < Params.size(); ++A) {
+        Impl << "&__a" << A << ",";
+      }
+      Impl << "};\n";
+    }
+    if (RetTy) {
+      Impl << "  " << P.print_def(RetTy, TypePrinter::Full, "__Ret") << ";\n";
+      Impl << "  " << Slot << ".Handler(" << Slot << ".Ctx, &__Ret, __Args);\n";
+      Impl << "  return __Ret;\n";
+    }
+    else {
+      Impl << "  " << Slot << ".Handler(" << Slot << ".Ctx, 0, __Args);\n";
+    }
+    Impl << "}\n";
+  }
+
+  std::stringstream Code;
+  Code << "#include <stdint.h>\n\n";
+  Code << P.getDecls() << "\n";
+  Code << "struct __dffi_closure_slot { void (*Handler)(void*, void*, void**); void* Ctx; };\n";
+  Code << "struct __dffi_closure_slot " << SlotsName << "[" << ChunkSize << "];\n";
+  Code << Impl.str();
+  Code << "void* " << PtrsName << "[] = {";
+  for (size_t I = 0; I < ChunkSize; ++I) {
+    Code << "(void*)&__dffi_closure_" << Suffix << "_" << I << ",";
+  }
+  Code << "};\n";
+
+  std::string Err;
+  std::stringstream ss;
+  ss << "/__dffi_private/closures_" << Suffix << ".c";
+  auto M = compile_llvm(Code.str(), ss.str(), Err);
+  if (!M) {
+    errs() << Code.str();
+    errs() << Err;
+    llvm::report_fatal_error("unable to compile closures!");
+  }
+  addModule(std::move(M));
+
+  auto* Slots = (ClosurePool::Slot*)getGlobalValueAddress(SlotsName);
+  auto* Ptrs = (void**)getGlobalValueAddress(PtrsName);
+  assert(Slots && Ptrs && "unable to find JITed closures!");
+  // Pop in order, so that the first closures are used first
+  for (size_t I = ChunkSize; I > 0; --I) {
+    Pool.Free.push_back({Ptrs[I-1], &Slots[I-1]});
+  }
+}
+
+NativeClosure DFFIImpl::getClosure(FunctionType const* FTy, NativeClosure::HandlerTy Handler, void* Ctx)
+{
+  assert(!FTy->hasVarArgs() && "closures can't be created for variadic functions!");
+  auto Ins = ClosurePools_.try_emplace(FTy);
+  auto& Pool = Ins.first->second;
+  if (Ins.second) {
+    Pool.TyIdx = ClosurePools_.size()-1;
+  }
+  if (Pool.Free.empty()) {
+    compileClosures(FTy, Pool);
+  }
+  auto E = Pool.Free.back();
+  Pool.Free.pop_back();
+  E.S->Handler = Handler;
+  E.S->Ctx = Ctx;
+  return {E.CodePtr, E.S, FTy};
+}
+
+void DFFIImpl::releaseClosure(FunctionType const* FTy, void* CodePtr, void* Slot)
+{
+  auto It = ClosurePools_.find(FTy);
+  assert(It != ClosurePools_.end() && "unknown closure pool!");
+  auto* S = static_cast<ClosurePool::Slot*>(Slot);
+  S->Handler = nullptr;
+  S->Ctx = nullptr;
+  It->second.Free.push_back({CodePtr, S});
+}
+
+NativeFunc DFFIImpl::getFunction(FunctionType const* FTy, void* FPtr, StringRef WrapperName, std::atomic<void*> const* CodeSlot)
+{
+  auto TFPtr = (NativeFunc::TrampPtrTy)getFunctionAddress(WrapperName);
+  assert(TFPtr && "direct function wrapper doesn't exist!");
+  return {TFPtr, FPtr, FTy, CodeSlot};
+}
+
+NativeFunc::FrameTrampPtrTy DFFIImpl::getFrameTrampoline(FunctionType const* FTy)
+{
+  std::lock_guard<std::mutex> Lock(TrampsMutex_);
+  auto It = FrameWrappers_.find(FTy);
+  if (It != FrameWrappers_.end()) {
+    return It->second;
+  }
+  const std::string Name = "__dffi_frame_wrapper_" + std::to_string(FrameWrappers_.size());
+  const auto Layout = FTy->getFrameLayout();
+  TypePrinter Printer;
+  std::stringstream Wrapper;
+  genWrapper(Printer, Wrapper, FTy, Name, "(__FPtr)", &Layout);
+  compileWrappers(Printer, Wrapper.str());
+  auto TFPtr = (NativeFunc::FrameTrampPtrTy)getFunctionAddress(Name);
+  assert(TFPtr && "frame trampoline doesn't exist!");
+  FrameWrappers_[FTy] = TFPtr;
+  return TFPtr;
+}
+
+NativeFunc::BatchTrampPtrTy DFFIImpl::getBatchTrampoline(FunctionType const* FTy)
+{
+  std::lock_guard<std::mutex> Lock(TrampsMutex_);
+  auto It = BatchWrappers_.find(FTy);
+  if (It != BatchWrappers_.end()) {
+    return It->second;
+  }
+  const std::string Name = "__dffi_batch_wrapper_" + std::to_string(BatchWrappers_.size());
+  TypePrinter Printer;
+  std::stringstream Wrapper;
+  genBatchWrapper(Printer, Wrapper, FTy, Name);
+  compileWrappers(Printer, Wrapper.str());
+  auto TFPtr = (NativeFunc::BatchTrampPtrTy)getFunctionAddress(Name);
+  assert(TFPtr && "batch trampoline doesn't exist!");
+  BatchWrappers_[FTy] = TFPtr;
+  return TFPtr;
+}
+
 BasicType const* DFFIImpl::getBasicType(BasicType::BasicKind K)
 {
   return getContext().getBasicType(*this, K);
@@ -570,6 +997,73 @@ ArrayType const* DFFIImpl::getArrayType(QualType Ty, uint64_t NElements)
   return getContext().getArrayType(*this, Ty, NElements);
 }
 
+VectorType const* DFFIImpl::getVectorType(BasicType const* Ty, unsigned NElements)
+{
+  return getContext().getVectorType(*this, Ty, NElements);
+}
+
+FunctionType const* DFFIImpl::getFunctionType(QualType RetTy, ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs)
+{
+  // C requires at least one parameter before the ellipsis
+  if (VarArgs && ParamsTy.empty()) {
+    return nullptr;
+  }
+  return getContext().getFunctionType(*this, RetTy, ParamsTy, CC, VarArgs);
+}
+
+static QualType promoteVarArg(DFFIImpl& Dffi, QualType Ty)
+{
+  // Default argument promotions (C11 6.5.2.2p6), after the decay of arrays
+  // and functions to pointers. Qualifiers aren't part of the promoted type.
+  auto* T = Ty.getType();
+  if (auto* ATy = dffi::dyn_cast<dffi::ArrayType>(T)) {
+    return Dffi.getPointerType(ATy->getElementType());
+  }
+  if (dffi::isa<dffi::FunctionType>(T)) {
+    return Dffi.getPointerType(T);
+  }
+  if (auto* ETy = dffi::dyn_cast<EnumType>(T)) {
+    T = ETy->getBasicType();
+  }
+  auto* BTy = dffi::dyn_cast<BasicType>(T);
+  if (!BTy) {
+    return T;
+  }
+  switch (BTy->getBasicKind()) {
+    case BasicType::Char:
+    case BasicType::Int8:
+    case BasicType::Int16:
+    case BasicType::UInt8:
+    case BasicType::UInt16:
+      return Dffi.getBasicType(BasicType::getKind<int>());
+    case BasicType::Float32:
+      return Dffi.getBasicType(BasicType::Float64);
+    default:
+      break;
+  };
+  return BTy;
+}
+
+FunctionType const* DFFIImpl::getVarArgsCallType(FunctionType const* FTy, ArrayRef<QualType> VarArgsTys)
+{
+  assert(FTy->hasVarArgs() && "function type isn't variadic!");
+  const size_t NFixed = FTy->getNumFixedParams();
+  assert(NFixed > 0 && "variadic functions need at least one fixed parameter!");
+  auto const& Params = FTy->getParams();
+  SmallVector<QualType, 8> CallParams(Params.begin(), Params.begin()+NFixed);
+  for (QualType Ty: VarArgsTys) {
+    CallParams.push_back(promoteVarArg(*this, Ty));
+  }
+  return getContext().getFunctionType(*this, FTy->getReturnType(), CallParams, FTy->getCC(), true, NFixed);
+}
+
+NativeFunc DFFIImpl::getVarArgsFunction(NativeFunc const& NF, ArrayRef<QualType> VarArgsTys)
+{
+  // Call types are interned, and so are their wrappers
+  auto* CallTy = getVarArgsCallType(NF.getType(), VarArgsTys);
+  return getFunction(CallTy, NF.getFuncCodePtr());
+}
+
 // Compilation unit
 //
 
@@ -591,6 +1085,13 @@ NativeFunc CUImpl::getFunction(StringRef Name)
   if (!FPtr) {
     return {};
   }
+  auto ItDirect = DirectWrappers_.find(Name);
+  if (ItDirect != DirectWrappers_.end()) {
+    // Frames and batches of tiered functions use their current code
+    auto ItSlot = CodeSlots_.find(Name);
+    return DFFI_.getFunction(ItFTy->second, FPtr, ItDirect->second,
+      ItSlot != CodeSlots_.end() ? ItSlot->second : nullptr);
+  }
   return DFFI_.getFunction(ItFTy->second, FPtr);
 }
 
@@ -653,7 +1154,7 @@ void CUImpl::declareDIComposite(DICompositeType const* DCTy)
 
   StringRef Name = DCTy->getName();
 
-  auto AddTy = [&](StringRef Name_) {
+  auto AddTy = [&](StringRef Name_, StringRef TyName) {
     CanOpaqueType* Ptr;
     switch (Tag) {
       case dwarf::DW_TAG_structure_type:
@@ -666,6 +1167,7 @@ void CUImpl::declareDIComposite(DICompositeType const* DCTy)
         Ptr = new EnumType{DFFI_};
         break;
     };
+    Ptr->Name_ = TyName.str();
     return CompositeTys_.try_emplace(Name_, std::unique_ptr<CanOpaqueType>{Ptr});
   };
 
@@ -674,7 +1176,7 @@ void CUImpl::declareDIComposite(DICompositeType const* DCTy)
     if (Name.startswith("__dffi")) {
       llvm::report_fatal_error("__dffi is a compiler reserved prefix and can't be used in a structure name!");
     }
-    AddTy(Name);
+    AddTy(Name, Name);
   }
   else {
     // Add to the map of anonymous types, and generate a name
@@ -684,7 +1186,7 @@ void CUImpl::declareDIComposite(DICompositeType const* DCTy)
     auto ID = AnonTys_.size() + 1;
     std::stringstream ss;
     ss << "__dffi_anon_struct_" << ID;
-    auto It = AddTy(ss.str());
+    auto It = AddTy(ss.str(), StringRef{});
     assert(It.second && "anonymous structure ID already existed!!");
     AnonTys_[DCTy] = It.first->second.get();
   }
@@ -873,6 +1375,13 @@ dffi::Type const* CUImpl::getTypeFromDIType(llvm::DIType const* Ty)
       {
         auto EltTy = getQualTypeFromDIType(DTy->getBaseType().resolve());
         auto Count = llvm::cast<DISubrange>(*DTy->getElements().begin())->getCount();
+        if (DTy->isVector()) {
+          auto* BTy = dffi::dyn_cast<BasicType>(EltTy.getType());
+          if (!BTy) {
+            llvm::report_fatal_error("unsupported vector element type");
+          }
+          return DFFI_.getVectorType(BTy, Count);
+        }
         //assert(DTy->getSizeInBits() == EltTy*Count*8 && "inconsistent size for array!");
         return DFFI_.getArrayType(EltTy, Count);
       }
@@ -892,18 +1401,24 @@ dffi::Type const* CUImpl::getTypeFromDIType(llvm::DIType const* Ty)
 dffi::FunctionType const* CUImpl::getFunctionType(DISubroutineType const* Ty)
 {
   auto ArrayTys = Ty->getTypeArray();
-  auto ItTy = ArrayTys.begin();
-
-  auto RetTy = getQualTypeFromDIType((*(ItTy++)).resolve());
+  auto RetTy = getQualTypeFromDIType(ArrayTys[0].resolve());
+
+  // The ellipsis of variadic functions is represented as a last null type
+  // (see DIBuilder::createUnspecifiedParameter).
+  unsigned NTys = ArrayTys.size();
+  const bool VarArgs = NTys > 1 && !ArrayTys[NTys-1];
+  if (VarArgs) {
+    --NTys;
+  }
 
   llvm::SmallVector<QualType, 8> ParamsTy;
-  ParamsTy.reserve(ArrayTys.size()-1);
-  for (auto ItEnd = ArrayTys.end(); ItTy != ItEnd; ++ItTy) {
-    auto ATy = getQualTypeFromDIType((*ItTy).resolve());
+  ParamsTy.reserve(NTys-1);
+  for (unsigned I = 1; I < NTys; ++I) {
+    auto ATy = getQualTypeFromDIType(ArrayTys[I].resolve());
     ParamsTy.push_back(ATy);
   }
   auto CC = dwarfCCToDFFI(Ty->getCC());
-  return getContext().getFunctionType(DFFI_, RetTy, ParamsTy, CC);
+  return getContext().getFunctionType(DFFI_, RetTy, ParamsTy, CC, VarArgs);
 }
 
 void CUImpl::parseFunctionAlias(Function& F)
@@ -15,8 +15,13 @@
 #ifndef DFFI_IMPL_H
 #define DFFI_IMPL_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <llvm/ADT/IntrusiveRefCntPtr.h>
 #include <llvm/ADT/StringRef.h>
@@ -36,6 +41,7 @@ namespace llvm {
 class Module;
 class Function;
 class TargetMachine;
+class TargetOptions;
 class ExecutionEngine;
 class DIType;
 class DICompositeType;
@@ -79,6 +85,69 @@ llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> getClangResFileSystem();
 const char* getClangResRootDirectory();
 
 struct CUImpl;
+struct DFFIImpl;
+
+// Prepares a copy of the IR of a compilation unit to be compiled alongside
+// it: mutable global variables become references to the original ones,
+// constant ones are made internal, and optnone attributes are removed.
+void shareGlobals(llvm::Module& M);
+// Makes FName the only function defined by M, renamed to TargetName. Other
+// functions are kept for inlining purposes (see shareGlobals).
+void isolateFunction(llvm::Module& M, llvm::StringRef FName, llvm::StringRef TargetName);
+void optimizeModule(llvm::Module& M, unsigned OptLevel, llvm::TargetMachine* TM, CCOpts const& Opts);
+llvm::TargetOptions getTargetOptions(CCOpts const& Opts);
+
+// Function of a compilation unit compiled with CCOpts::TieredCompilation.
+// Its wrapper counts its calls, and calls it through Code, which is swapped
+// with an optimized version once Count reaches CCOpts::TierUpThreshold.
+struct TieredFunc
+{
+  std::atomic<void*> Code;
+  std::atomic<uint32_t> Count;
+  CUImpl* CU;
+  std::string Name;
+};
+
+// Background thread which recompiles hot tiered functions
+struct TierUpWorker
+{
+  TierUpWorker(DFFIImpl& DFFI);
+  ~TierUpWorker();
+
+  void push(TieredFunc* F);
+
+private:
+  void run();
+
+  DFFIImpl& DFFI_;
+  std::mutex Mutex_;
+  std::condition_variable Cond_;
+  std::deque<TieredFunc*> Queue_;
+  bool Stop_;
+  std::thread Thread_;
+};
+
+// Pool of JIT-compiled closures for a given function type. Closures are
+// compiled by chunks, and each one forwards its calls to the handler stored
+// in its own slot.
+struct ClosurePool
+{
+  struct Slot
+  {
+    NativeClosure::HandlerTy Handler;
+    void* Ctx;
+  };
+
+  struct Entry
+  {
+    void* CodePtr;
+    Slot* S;
+  };
+
+  size_t TyIdx;
+  size_t NChunks = 0;
+  std::vector<Entry> Free;
+};
 
 struct DFFIImpl
 {
@@ -92,18 +161,53 @@ struct DFFIImpl
   BasicType const* getBasicType(BasicType::BasicKind K);
   PointerType const* getPointerType(QualType Ty);
   ArrayType const* getArrayType(QualType Ty, uint64_t NElements);
+  VectorType const* getVectorType(BasicType const* Ty, unsigned NElements);
+  FunctionType const* getFunctionType(QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs = false);
+  FunctionType const* getVarArgsCallType(FunctionType const* FTy, llvm::ArrayRef<QualType> VarArgsTys);
   NativeFunc getFunction(FunctionType const* FTy, void* FPtr);
+  NativeFunc getVarArgsFunction(NativeFunc const& NF, llvm::ArrayRef<QualType> VarArgsTys);
+  NativeFunc getFunction(FunctionType const* FTy, void* FPtr, llvm::StringRef WrapperName, std::atomic<void*> const* CodeSlot = nullptr);
+  NativeFunc::FrameTrampPtrTy getFrameTrampoline(FunctionType const* FTy);
+  NativeFunc::BatchTrampPtrTy getBatchTrampoline(FunctionType const* FTy);
+
+  NativeFunc specialize(NativeFunc const& NF, std::map<unsigned, void const*> const& Args, std::string& Err);
+
+  NativeClosure getClosure(FunctionType const* FTy, NativeClosure::HandlerTy Handler, void* Ctx);
+  void releaseClosure(FunctionType const* FTy, void* CodePtr, void* Slot);
+
+  // Recompiles F at -O3 for the target CPU, and swaps its code with the
+  // optimized one. Called from the tier-up worker thread.
+  void tierUp(TieredFunc& F);
+  void scheduleTierUp(TieredFunc& F) { TierWorker_->push(&F); }
+
+  // Recompiles CU with the profile collected by its counters (see
+  // CCOpts::ProfileInstrument)
+  bool optimizeWithProfile(CUImpl& CU, std::string& Err);
 
 protected:
   DFFICtx& getContext() { return DCtx_; }
   DFFICtx const& getContext() const { return DCtx_; }
   void* getFunctionAddress(llvm::StringRef Name);
+  // Returns the address of a global variable defined in the EE
+  void* getGlobalValueAddress(llvm::StringRef Name);
+  // Adds M to the EE and generates its code
+  void addModule(std::unique_ptr<llvm::Module> M);
 
 private:
   std::unique_ptr<llvm::Module> compile_llvm_with_decls(llvm::StringRef const Code, llvm::StringRef const CUName, FuncAliasesMap& FuncAliases, std::string& Err);
   std::unique_ptr<llvm::Module> compile_llvm(llvm::StringRef const Code, llvm::StringRef const CUName, std::string& Err);
 
   void genFuncTypeWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy);
+  std::string genWrapperArgs(TypePrinter& P, FunctionType const* FTy, FunctionType::FrameLayout const* Frame);
+  void genWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy, llvm::StringRef Name, llvm::StringRef Callee, FunctionType::FrameLayout const* Frame = nullptr);
+  void genBatchWrapper(TypePrinter& P, std::stringstream& ss, FunctionType const* FTy, llvm::StringRef Name);
+  void linkDirectWrappers(CUImpl& CU, llvm::Module& M);
+  void compileTieredWrappers(CUImpl& CU);
+  void instrumentModule(CUImpl& CU, llvm::Module& M);
+  void compileWrappers(TypePrinter& P, std::string const& Wrappers);
+  std::unique_ptr<llvm::Module> cloneForSpecialization(void* FPtr, std::string const& TargetName);
+  void optimizeModule(llvm::Module& M);
+  void compileClosures(FunctionType const* FTy, ClosurePool& Pool);
   void getCompileError(std::string& Err);
   void setNewDiagnostics();
 
@@ -121,12 +225,23 @@ private:
   llvm::IntrusiveRefCntPtr<clang::FileManager> FileMgr_;
   llvm::SmallVector<std::unique_ptr<CUImpl>, 8> CUs_;
   llvm::DenseMap<dffi::FunctionType const*, size_t> FuncTyWrappers_;
+  llvm::DenseMap<dffi::FunctionType const*, ClosurePool> ClosurePools_;
+  // Frame and batch trampolines are compiled on the first call through
+  // them, which can happen in several threads at once.
+  std::mutex TrampsMutex_;
+  llvm::DenseMap<dffi::FunctionType const*, NativeFunc::FrameTrampPtrTy> FrameWrappers_;
+  llvm::DenseMap<dffi::FunctionType const*, NativeFunc::BatchTrampPtrTy> BatchWrappers_;
 
   DFFICtx DCtx_;
 
   CCOpts Opts_;
 
   size_t CUIdx_ = 0;
+  size_t SpecIdx_ = 0;
+  size_t PGOIdx_ = 0;
+
+  // Declared last, so that it's stopped before anything else is destroyed
+  std::unique_ptr<TierUpWorker> TierWorker_;
 };
 
 struct CUImpl
@@ -163,6 +278,7 @@ struct CUImpl
 
   std::vector<std::string> getTypes() const;
   std::vector<std::string> getFunctions() const;
+  std::vector<std::pair<std::string, uint64_t>> getHotFunctions() const;
 
   DFFIImpl& DFFI_;
 
@@ -173,6 +289,25 @@ struct CUImpl
 
   // Temporary map used during debug metadata parsing
   AnonTysMap AnonTys_;
+
+  // Copy of the compiled IR, used for function specialization
+  std::unique_ptr<llvm::Module> IRModule_;
+
+  // Function name => direct wrapper name (see CCOpts::DirectTrampolines)
+  llvm::StringMap<std::string> DirectWrappers_;
+
+  // Bitcode of IRModule_, used to recompile hot functions in the background
+  // (see CCOpts::TieredCompilation)
+  std::string Bitcode_;
+  std::vector<std::unique_ptr<TieredFunc>> TieredFuncs_;
+  // Function name => its TieredFunc::Code
+  llvm::StringMap<std::atomic<void*> const*> CodeSlots_;
+
+  // Profile counters of an instrumented compilation unit, and index of the
+  // entry counter of each function
+  uint64_t* ProfCounters_ = nullptr;
+  size_t NumProfCounters_ = 0;
+  std::vector<std::pair<std::string, size_t>> ProfEntries_;
 };
 
 struct ASTGenWrappersAction: public clang::ASTFrontendAction
@@ -69,13 +69,11 @@ private:
     auto* FTy = FD->getType()->getAs<clang::FunctionType>();
     assert(FTy);
 
-    bool IsVariadic = false;
+    // Variadic functions are kept: the definition printed below keeps the
+    // ellipsis, and each call shape gets its own trampoline (see
+    // FunctionType::getVarArgsCallType).
     bool NoReturn = FTy->getExtInfo().getNoReturn();
-    if (auto* PFTy = FTy->getAs<clang::FunctionProtoType>()) {
-      IsVariadic = PFTy->isVariadic();
-    }
-
-    if (IsVariadic || NoReturn) {
+    if (NoReturn) {
       // TODO: save the info we ignored a function somewhere!
       return;
     }
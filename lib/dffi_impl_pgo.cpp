@@ -0,0 +1,174 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <algorithm>
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+#include <dffi/casting.h>
+#include "dffi_impl.h"
+
+using namespace llvm;
+
+namespace dffi {
+namespace details {
+
+// Profiled points of a function are its entry block, and each successor of
+// its multi-way branches, in this order. The instrumented module and the
+// clean copy of the IR (CUImpl::IRModule_) give the same sequence.
+
+namespace {
+
+void getProfiledBranches(Function& F, SmallVectorImpl<TerminatorInst*>& TIs)
+{
+  for (BasicBlock& BB: F) {
+    auto* TI = BB.getTerminator();
+    if ((isa<BranchInst>(TI) || isa<SwitchInst>(TI)) && TI->getNumSuccessors() > 1) {
+      TIs.push_back(TI);
+    }
+  }
+}
+
+} // anonymous
+
+void DFFIImpl::instrumentModule(CUImpl& CU, Module& M)
+{
+  // Counted blocks, in the order of their counters. Critical edges are
+  // split, so that each successor of a branch is only reached through it.
+  SmallVector<BasicBlock*, 64> Blocks;
+  for (Function& F: M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    CU.ProfEntries_.emplace_back(F.getName().str(), Blocks.size());
+    Blocks.push_back(&F.getEntryBlock());
+    SmallVector<TerminatorInst*, 16> TIs;
+    getProfiledBranches(F, TIs);
+    for (auto* TI: TIs) {
+      for (unsigned I = 0, N = TI->getNumSuccessors(); I < N; ++I) {
+        SplitCriticalEdge(TI, I);
+        Blocks.push_back(TI->getSuccessor(I));
+      }
+    }
+  }
+  CU.NumProfCounters_ = Blocks.size();
+  if (Blocks.empty()) {
+    return;
+  }
+
+  auto* Int64Ty = Type::getInt64Ty(M.getContext());
+  auto* CntsTy = llvm::ArrayType::get(Int64Ty, Blocks.size());
+  auto* Cnts = new GlobalVariable(M, CntsTy, false, GlobalValue::ExternalLinkage,
+    ConstantAggregateZero::get(CntsTy), "__dffi_prof_" + std::to_string(CUs_.size()));
+  // Counters are atomically incremented, as instrumented functions can run
+  // in several threads (e.g. with OpenMP).
+  for (size_t I = 0; I < Blocks.size(); ++I) {
+    IRBuilder<> B(&*Blocks[I]->getFirstInsertionPt());
+    Value* Ptr = B.CreateConstInBoundsGEP2_64(Cnts, 0, I);
+    B.CreateAtomicRMW(AtomicRMWInst::Add, Ptr, B.getInt64(1), AtomicOrdering::Monotonic);
+  }
+}
+
+bool DFFIImpl::optimizeWithProfile(CUImpl& CU, std::string& Err)
+{
+  if (!CU.ProfCounters_) {
+    Err = "compilation unit isn't instrumented";
+    return false;
+  }
+
+  // The profile is applied as function entry counts and branch weights on a
+  // clean copy of the IR.
+  auto M = CloneModule(CU.IRModule_.get());
+  MDBuilder MDB(M->getContext());
+  size_t Idx = 0;
+  for (Function& F: *M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    F.setEntryCount(CU.ProfCounters_[Idx++]);
+    SmallVector<TerminatorInst*, 16> TIs;
+    getProfiledBranches(F, TIs);
+    for (auto* TI: TIs) {
+      const unsigned N = TI->getNumSuccessors();
+      uint64_t const* Counts = &CU.ProfCounters_[Idx];
+      Idx += N;
+      const uint64_t Max = *std::max_element(Counts, Counts+N);
+      if (Max == 0) {
+        continue;
+      }
+      // Weights are 32-bit integers
+      const uint64_t Scale = Max/UINT32_MAX + 1;
+      SmallVector<uint32_t, 4> Weights;
+      for (unsigned I = 0; I < N; ++I) {
+        Weights.push_back(Counts[I]/Scale);
+      }
+      TI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Weights));
+    }
+  }
+  assert(Idx == CU.NumProfCounters_ && "profile doesn't match the compilation unit!");
+
+  // The new version of every function has its own name, and uses the global
+  // variables of the original compilation unit.
+  shareGlobals(*M);
+  const std::string Suffix = "__dffi_pgo_" + std::to_string(PGOIdx_++);
+  for (Function& F: *M) {
+    if (F.isDeclaration() || F.hasLocalLinkage()) {
+      continue;
+    }
+    F.setComdat(nullptr);
+    F.setName(F.getName() + Suffix);
+  }
+  details::optimizeModule(*M, std::max(Opts_.OptLevel, 2U), EE_->getTargetMachine(), Opts_);
+
+  addModule(std::move(M));
+
+  for (auto& TF: CU.TieredFuncs_) {
+    if (void* Code = getFunctionAddress(TF->Name + Suffix)) {
+      TF->Code.store(Code, std::memory_order_release);
+    }
+  }
+  return true;
+}
+
+std::vector<std::pair<std::string, uint64_t>> CUImpl::getHotFunctions() const
+{
+  std::vector<std::pair<std::string, uint64_t>> Ret;
+  if (!ProfCounters_) {
+    return Ret;
+  }
+  for (auto const& E: ProfEntries_) {
+    const uint64_t Count = ProfCounters_[E.second];
+    if (Count > 0) {
+      Ret.emplace_back(E.first, Count);
+    }
+  }
+  std::stable_sort(Ret.begin(), Ret.end(),
+    [](std::pair<std::string, uint64_t> const& A, std::pair<std::string, uint64_t> const& B) {
+      return A.second > B.second;
+    });
+  return Ret;
+}
+
+} // details
+} // dffi
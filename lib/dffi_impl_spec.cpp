@@ -0,0 +1,252 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+#include <dffi/casting.h>
+#include "dffi_impl.h"
+#include "types_printer.h"
+
+using namespace llvm;
+
+namespace dffi {
+namespace details {
+
+void shareGlobals(Module& M)
+{
+  // Mutable global variables are shared with the original compilation
+  // unit, whereas constant ones are copied so that they can be folded.
+  for (GlobalVariable& GV: M.globals()) {
+    if (GV.isDeclaration()) {
+      continue;
+    }
+    GV.setComdat(nullptr);
+    if (GV.isConstant()) {
+      GV.setLinkage(GlobalValue::InternalLinkage);
+    }
+    else {
+      GV.setInitializer(nullptr);
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  }
+  // Compilation units built at -O0 (see CCOpts::TieredCompilation) have
+  // their functions marked as optnone, which would prevent any
+  // reoptimization.
+  for (Function& MF: M) {
+    if (MF.hasFnAttribute(Attribute::OptimizeNone)) {
+      MF.removeFnAttr(Attribute::OptimizeNone);
+      MF.removeFnAttr(Attribute::NoInline);
+    }
+  }
+}
+
+void isolateFunction(Module& M, StringRef FName, StringRef TargetName)
+{
+  shareGlobals(M);
+  for (Function& MF: M) {
+    // Function bodies are only kept for inlining purposes. Internal ones
+    // are copied.
+    if (MF.isDeclaration() || MF.hasLocalLinkage()) {
+      continue;
+    }
+    MF.setComdat(nullptr);
+    MF.setLinkage(GlobalValue::AvailableExternallyLinkage);
+  }
+  Function* Target = M.getFunction(FName);
+  Target->setName(TargetName);
+  Target->setLinkage(GlobalValue::ExternalLinkage);
+}
+
+void optimizeModule(Module& M, unsigned OptLevel, TargetMachine* TM, CCOpts const& Opts)
+{
+  legacy::PassManager MPM;
+  legacy::FunctionPassManager FPM(&M);
+  PassManagerBuilder PMB;
+  PMB.OptLevel = OptLevel;
+  PMB.SizeLevel = 0;
+  if (OptLevel > 0) {
+    PMB.Inliner = createFunctionInliningPass(OptLevel, 0, false);
+  }
+  PMB.LoopVectorize = Opts.Vectorize && OptLevel >= 2;
+  PMB.SLPVectorize = Opts.Vectorize && OptLevel >= 2;
+  PMB.DisableUnrollLoops = !Opts.Unroll;
+  if (TM) {
+    TM->adjustPassManager(PMB);
+    MPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    FPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+  }
+  PMB.populateFunctionPassManager(FPM);
+  PMB.populateModulePassManager(MPM);
+
+  FPM.doInitialization();
+  for (Function& F: M) {
+    FPM.run(F);
+  }
+  FPM.doFinalization();
+  MPM.run(M);
+}
+
+std::unique_ptr<Module> DFFIImpl::cloneForSpecialization(void* FPtr, std::string const& TargetName)
+{
+  for (auto& CU: CUs_) {
+    if (!CU->IRModule_) {
+      continue;
+    }
+    for (auto const& It: CU->FuncTys_) {
+      Function* F = CU->IRModule_->getFunction(It.getKey());
+      if (!F || F->isDeclaration() || getFunctionAddress(It.getKey()) != FPtr) {
+        continue;
+      }
+      auto M = CloneModule(CU->IRModule_.get());
+      isolateFunction(*M, It.getKey(), TargetName);
+      return M;
+    }
+  }
+  return nullptr;
+}
+
+void DFFIImpl::optimizeModule(Module& M)
+{
+  details::optimizeModule(M, Opts_.OptLevel, EE_->getTargetMachine(), Opts_);
+}
+
+NativeFunc DFFIImpl::specialize(NativeFunc const& NF, std::map<unsigned, void const*> const& Args, std::string& Err)
+{
+  auto* FTy = NF.getType();
+  if (FTy->hasVarArgs()) {
+    Err = "variadic functions can't be specialized";
+    return {};
+  }
+  auto const& Params = FTy->getParams();
+  for (auto const& A: Args) {
+    if (A.first >= Params.size()) {
+      Err = "argument index " + std::to_string(A.first) + " is out of range";
+      return {};
+    }
+  }
+
+  const std::string Suffix = std::to_string(SpecIdx_++);
+  const std::string SpecName = "__dffi_spec_" + Suffix;
+  const std::string TargetName = "__dffi_spec_target_" + Suffix;
+
+  // If the IR of the function is available, the specialized function is
+  // linked with a copy of it so that it can be reoptimized with the bound
+  // constants. Otherwise, the original function is called through its
+  // address.
+  auto M = cloneForSpecialization(NF.getFuncCodePtr(), TargetName);
+
+  TypePrinter P;
+  std::stringstream Body;
+  if (M) {
+    Body << P.print_def(FTy, TypePrinter::Full, TargetName.c_str()) << ";\n";
+  }
+
+  // Bound values are stored as constant bytes, which works for any type (and
+  // can still be folded by the optimizer).
+  FunctionType::ParamsVecTy SpecParams;
+  std::stringstream Decl;
+  std::stringstream CallArgs;
+  for (size_t I = 0; I < Params.size(); ++I) {
+    if (I > 0) {
+      CallArgs << ",";
+    }
+    QualType ATy = Params[I];
+    auto It = Args.find(I);
+    if (It == Args.end()) {
+      if (!SpecParams.empty()) {
+        Decl << ",";
+      }
+      const std::string AName = "__a" + std::to_string(I);
+      Decl << P.print_def(ATy, TypePrinter::Full, AName.c_str());
+      CallArgs << AName;
+      SpecParams.push_back(ATy);
+      continue;
+    }
+    const std::string CstName = "__dffi_cst_" + std::to_string(I);
+    const size_t Size = ATy->getSize();
+    auto const* Bytes = static_cast<uint8_t const*>(It->second);
+    Body << "static const union { " << P.print_def(ATy.getType(), TypePrinter::Full, "v") << "; ";
+    Body << "unsigned char b[" << Size << "]; } " << CstName << " = {.b = {";
+    for (size_t B = 0; B < Size; ++B) {
+      Body << (unsigned)Bytes[B] << ",";
+    }
+    Body << "}};\n";
+    CallArgs << CstName << ".v";
+  }
+  if (SpecParams.empty()) {
+    Decl << "void";
+  }
+
+  std::stringstream Callee;
+  if (M) {
+    Callee << TargetName;
+  }
+  else {
+    Callee << "((" << P.print_def(getPointerType(FTy), TypePrinter::Full) << ")0x" << std::hex << (uintptr_t)NF.getFuncCodePtr() << std::dec << "ULL)";
+  }
+
+  auto* RetTy = FTy->getReturnType();
+  const std::string SpecDecl = SpecName + "(" + Decl.str() + ")";
+  Body << P.print_def(RetTy, TypePrinter::Full, SpecDecl.c_str()) << " {\n  ";
+  if (RetTy) {
+    Body << "return ";
+  }
+  Body << Callee.str() << "(" << CallArgs.str() << ");\n}\n";
+
+  std::string Code = "#include <stdint.h>\n\n";
+  Code += P.getDecls() + "\n" + Body.str();
+  auto SpecM = compile_llvm(Code, "/__dffi_private/spec_" + Suffix + ".c", Err);
+  if (!SpecM) {
+    return {};
+  }
+  llvm::StripDebugInfo(*SpecM);
+
+  if (M) {
+    if (Linker::linkModules(*M, std::move(SpecM))) {
+      Err = "unable to link the specialized function with its original module";
+      return {};
+    }
+    M->getFunction(TargetName)->setLinkage(GlobalValue::InternalLinkage);
+    optimizeModule(*M);
+  }
+  else {
+    M = std::move(SpecM);
+  }
+
+  addModule(std::move(M));
+
+  void* SpecPtr = getFunctionAddress(SpecName);
+  if (!SpecPtr) {
+    Err = "unable to find the specialized function";
+    return {};
+  }
+  auto* SpecFTy = getFunctionType(RetTy, SpecParams, CC_C);
+  return getFunction(SpecFTy, SpecPtr);
+}
+
+} // details
+} // dffi
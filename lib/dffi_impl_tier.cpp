@@ -0,0 +1,226 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <algorithm>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/MutexGuard.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+#include <dffi/casting.h>
+#include "dffi_impl.h"
+#include "types_printer.h"
+
+using namespace llvm;
+
+namespace dffi {
+namespace details {
+
+namespace {
+
+// Called by the wrapper of a tiered function once it reaches the tier-up
+// threshold, from the thread that called it.
+void tierUpHandler(void* F)
+{
+  auto* TF = static_cast<TieredFunc*>(F);
+  TF->CU->DFFI_.scheduleTierUp(*TF);
+}
+
+std::string hexPtr(void const* Ptr)
+{
+  std::stringstream ss;
+  ss << "0x" << std::hex << (uintptr_t)Ptr << "ULL";
+  return ss.str();
+}
+
+} // anonymous
+
+TierUpWorker::TierUpWorker(DFFIImpl& DFFI):
+  DFFI_(DFFI),
+  Stop_(false),
+  Thread_([this]() { run(); })
+{ }
+
+TierUpWorker::~TierUpWorker()
+{
+  {
+    std::lock_guard<std::mutex> Lock(Mutex_);
+    Stop_ = true;
+  }
+  Cond_.notify_one();
+  Thread_.join();
+}
+
+void TierUpWorker::push(TieredFunc* F)
+{
+  {
+    std::lock_guard<std::mutex> Lock(Mutex_);
+    Queue_.push_back(F);
+  }
+  Cond_.notify_one();
+}
+
+void TierUpWorker::run()
+{
+  while (true) {
+    TieredFunc* F;
+    {
+      std::unique_lock<std::mutex> Lock(Mutex_);
+      Cond_.wait(Lock, [this]() { return Stop_ || !Queue_.empty(); });
+      if (Stop_) {
+        return;
+      }
+      F = Queue_.front();
+      Queue_.pop_front();
+    }
+    DFFI_.tierUp(*F);
+  }
+}
+
+void DFFIImpl::compileTieredWrappers(CUImpl& CU)
+{
+  // Each function defined by the compilation unit gets a wrapper which
+  // calls the current version of its code, and counts its calls with tiered
+  // compilation. External functions use the function type wrappers.
+  TypePrinter P;
+  std::stringstream ss;
+  const std::string Prefix = "__dffi_tier_" + std::to_string(CUs_.size()) + "_";
+  if (Opts_.TieredCompilation) {
+    // The counter stops being incremented once the threshold is reached, so
+    // that it never wraps around and the handler is only called once. A
+    // threshold of 0 is handled as 1.
+    const unsigned Threshold = std::max(Opts_.TierUpThreshold, 1U);
+    ss << "static void __dffi_tier_count(uint32_t* __Count, void* __F) {\n";
+    ss << "  if (__atomic_load_n(__Count, __ATOMIC_RELAXED) >= " << Threshold << "U) return;\n";
+    ss << "  if (__atomic_add_fetch(__Count, 1, __ATOMIC_RELAXED) == " << Threshold << "U) {\n";
+    ss << "    ((void(*)(void*))" << hexPtr((void const*)&tierUpHandler) << ")(__F);\n";
+    ss << "  }\n";
+    ss << "}\n";
+  }
+  size_t Idx = 0;
+  for (auto const& It: CU.FuncTys_) {
+    Function* F = CU.IRModule_->getFunction(It.getKey());
+    if (!F || F->isDeclaration()) {
+      continue;
+    }
+    void* Ptr = getFunctionAddress(It.getKey());
+    if (!Ptr) {
+      continue;
+    }
+    std::unique_ptr<TieredFunc> TF{new TieredFunc};
+    TF->Code = Ptr;
+    TF->Count = 0;
+    TF->CU = &CU;
+    TF->Name = It.getKey();
+
+    auto* FTy = It.second;
+    std::stringstream Callee;
+    Callee << "(";
+    if (Opts_.TieredCompilation) {
+      Callee << "__dffi_tier_count((uint32_t*)" << hexPtr(&TF->Count) << ",(void*)" << hexPtr(TF.get()) << "),";
+    }
+    Callee << "__atomic_load_n((" << P.print_def(getPointerType(getPointerType(FTy)), TypePrinter::Full) << ")";
+    Callee << hexPtr(&TF->Code) << ", __ATOMIC_ACQUIRE))";
+    const std::string WName = Prefix + std::to_string(Idx++);
+    genWrapper(P, ss, FTy, WName, Callee.str());
+    CU.DirectWrappers_[It.getKey()] = WName;
+    CU.CodeSlots_[It.getKey()] = &TF->Code;
+    CU.TieredFuncs_.emplace_back(std::move(TF));
+  }
+  if (CU.TieredFuncs_.empty()) {
+    return;
+  }
+  compileWrappers(P, ss.str());
+}
+
+void DFFIImpl::tierUp(TieredFunc& F)
+{
+  // Everything is done in a private context, as the main one can be
+  // concurrently used by the thread that owns this object.
+  LLVMContext Ctx;
+  auto MOrErr = parseBitcodeFile(MemoryBufferRef{F.CU->Bitcode_, F.Name}, Ctx);
+  if (!MOrErr) {
+    consumeError(MOrErr.takeError());
+    return;
+  }
+  std::unique_ptr<Module> M = std::move(*MOrErr);
+
+  const std::string Triple = M->getTargetTriple();
+  std::string Error;
+  const llvm::Target* Tgt = TargetRegistry::lookupTarget(Triple, Error);
+  if (!Tgt) {
+    return;
+  }
+  SubtargetFeatures Features;
+  for (auto const& Feat: Opts_.Features) {
+    Features.AddFeature(Feat);
+  }
+  std::unique_ptr<TargetMachine> TM{Tgt->createTargetMachine(Triple, Opts_.CPU,
+    Features.getString(), getTargetOptions(Opts_), Reloc::PIC_, CodeModel::Small, CodeGenOpt::Aggressive)};
+  if (!TM) {
+    return;
+  }
+
+  std::stringstream ss;
+  ss << "__dffi_tier_up_" << std::hex << (uintptr_t)&F;
+  const std::string TargetName = ss.str();
+  isolateFunction(*M, F.Name, TargetName);
+  M->setDataLayout(TM->createDataLayout());
+  optimizeModule(*M, 3, TM.get(), Opts_);
+
+  SmallVector<char, 0> ObjBuf;
+  {
+    raw_svector_ostream OS(ObjBuf);
+    legacy::PassManager PM;
+    if (TM->addPassesToEmitFile(PM, OS, TargetMachine::CGFT_ObjectFile)) {
+      return;
+    }
+    PM.run(*M);
+  }
+  auto Buf = MemoryBuffer::getMemBufferCopy(StringRef{ObjBuf.data(), ObjBuf.size()}, TargetName);
+  auto ObjOrErr = object::ObjectFile::createObjectFile(Buf->getMemBufferRef());
+  if (!ObjOrErr) {
+    consumeError(ObjOrErr.takeError());
+    return;
+  }
+
+  // The object references the global variables and functions of the
+  // original compilation unit, which are resolved by the EE.
+  void* Code;
+  {
+    MutexGuard Lock(EE_->lock);
+    EE_->addObjectFile(object::OwningBinary<object::ObjectFile>{std::move(*ObjOrErr), std::move(Buf)});
+    Code = (void*)EE_->getFunctionAddress(TargetName);
+  }
+  if (Code) {
+    F.Code.store(Code, std::memory_order_release);
+  }
+}
+
+} // details
+} // dffi
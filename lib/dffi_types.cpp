@@ -12,6 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
+#include <llvm/Support/MathExtras.h>
+
 #include <dffi/dffi.h>
 #include <dffi/composite_type.h>
 #include <dffi/casting.h>
@@ -74,13 +78,21 @@ uint64_t BasicType::getSize() const
   }
 }
 
-FunctionType::FunctionType(details::DFFIImpl& Dffi, QualType RetTy, ParamsVecTy ParamsTy, CallingConv CC):
+FunctionType::FunctionType(details::DFFIImpl& Dffi, QualType RetTy, ParamsVecTy ParamsTy, CallingConv CC, bool VarArgs, size_t NFixedParams):
   Type(Dffi, TY_Function),
   RetTy_(RetTy),
-  ParamsTy_(std::move(ParamsTy))
+  ParamsTy_(std::move(ParamsTy)),
+  NFixedParams_(NFixedParams)
 {
+  assert(NFixedParams <= ParamsTy_.size() && "invalid number of fixed parameters!");
+  assert((VarArgs || NFixedParams == ParamsTy_.size()) && "only variadic functions can have non fixed parameters!");
   Flags_.D.CC = CC;
-  Flags_.D.VarArgs = 0;
+  Flags_.D.VarArgs = VarArgs;
+}
+
+FunctionType const* FunctionType::getVarArgsCallType(ParamsVecTy const& VarArgsTys) const
+{
+  return getDFFI().getVarArgsCallType(this, VarArgsTys);
 }
 
 NativeFunc FunctionType::getFunction(void* Ptr) const
@@ -88,11 +100,39 @@ NativeFunc FunctionType::getFunction(void* Ptr) const
   return getDFFI().getFunction(this, Ptr);
 }
 
+NativeClosure FunctionType::getClosure(NativeClosure::HandlerTy Handler, void* Ctx) const
+{
+  return getDFFI().getClosure(this, Handler, Ctx);
+}
+
+FunctionType::FrameLayout FunctionType::getFrameLayout() const
+{
+  FrameLayout Ret;
+  Ret.Offsets.reserve(ParamsTy_.size());
+  uint64_t Off = 0;
+  unsigned Align = 1;
+  for (QualType PTy: ParamsTy_) {
+    const unsigned PAlign = PTy->getAlign();
+    Off = llvm::alignTo(Off, PAlign);
+    Ret.Offsets.push_back(Off);
+    Off += PTy->getSize();
+    Align = std::max(Align, PAlign);
+  }
+  Ret.Size = llvm::alignTo(Off, Align);
+  Ret.Align = Align;
+  return Ret;
+}
+
 PointerType::PointerType(details::DFFIImpl& Dffi, QualType Pointee):
   Type(Dffi, TY_Pointer),
   Pointee_(Pointee)
 { }
 
+BasicType const* BasicType::get(Type const* Ty, BasicKind K)
+{
+  return Ty->getDFFI().getBasicType(K);
+}
+
 PointerType const* PointerType::get(QualType Ty)
 {
   return Ty->getDFFI().getPointerType(Ty);
@@ -109,6 +149,17 @@ ArrayType::ArrayType(details::DFFIImpl& Dffi, QualType Ty, uint64_t NElements):
   NElements_(NElements)
 { }
 
+VectorType::VectorType(details::DFFIImpl& Dffi, BasicType const* Ty, unsigned NElements):
+  Type(Dffi, TY_Vector),
+  Ty_(Ty),
+  NElements_(NElements)
+{ }
+
+uint64_t VectorType::getSize() const
+{
+  return llvm::PowerOf2Ceil(Ty_->getSize()*NElements_);
+}
+
 CompositeField::CompositeField(const char* Name, Type const* Ty, unsigned Offset):
   Name_(Name),
   Ty_(Ty),
@@ -61,14 +61,28 @@ ArrayType* details::DFFICtx::getArrayType(DFFIImpl& Dffi, QualType EltTy, uint64
   return Ret;
 }
 
-FunctionType* details::DFFICtx::getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC)
+VectorType* details::DFFICtx::getVectorType(DFFIImpl& Dffi, BasicType const* EltTy, unsigned NElements)
 {
-  FunctionTypeKeyInfo::KeyTy K(RetTy, ParamsTy, CC, false);
+  auto& Ret = VectorTys_[std::make_pair(EltTy, NElements)];
+  if (!Ret) {
+    Ret.reset(new VectorType{Dffi, EltTy, NElements});
+  }
+  return Ret.get();
+}
+
+FunctionType* details::DFFICtx::getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs)
+{
+  return getFunctionType(Dffi, RetTy, ParamsTy, CC, VarArgs, ParamsTy.size());
+}
+
+FunctionType* details::DFFICtx::getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs, size_t NFixedParams)
+{
+  FunctionTypeKeyInfo::KeyTy K(RetTy, ParamsTy, CC, VarArgs, NFixedParams);
   auto It = FunctionTys_.find_as(K);
   if (It != FunctionTys_.end()) {
     return *It;
   }
-  auto* Ret = new FunctionType{Dffi, RetTy, ParamsTy, CC};
+  auto* Ret = new FunctionType{Dffi, RetTy, ParamsTy, CC, VarArgs, NFixedParams};
   FunctionTys_.insert(Ret);
   return Ret;
 }
@@ -62,22 +62,26 @@ struct FunctionTypeKeyInfo
       } D;
       uint8_t V;
     } Flags_;
+    size_t NFixedParams_;
 
-    KeyTy(QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool hasVarArgs):
+    KeyTy(QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool hasVarArgs, size_t NFixedParams):
       RetTy_(RetTy),
-      ParamsTy_(ParamsTy)
+      ParamsTy_(ParamsTy),
+      NFixedParams_(NFixedParams)
     {
       Flags_.D.CC = CC;
       Flags_.D.VarArgs = hasVarArgs;
     }
 
     KeyTy(FunctionType const* FT):
-      KeyTy(FT->getReturnType(), FT->getParams(), FT->getCC(), FT->hasVarArgs())
+      KeyTy(FT->getReturnType(), FT->getParams(), FT->getCC(), FT->hasVarArgs(), FT->getNumFixedParams())
     { }
 
     bool operator==(KeyTy const& O) const {
       if (Flags_.V != O.Flags_.V) 
         return false;
+      if (NFixedParams_ != O.NFixedParams_)
+        return false;
       if (RetTy_ != O.RetTy_) 
         return false;
       return ParamsTy_ == O.ParamsTy_;
@@ -103,6 +107,7 @@ struct FunctionTypeKeyInfo
       Hash ^= std::hash<QualType>{}(PTy);
     }
     Hash ^= Key.Flags_.V;
+    Hash ^= Key.NFixedParams_ << 8;
     return Hash;
   }
 
@@ -129,7 +134,7 @@ struct ArrayTypeKeyInfo
 
     KeyTy(QualType EltTy, uint64_t NumElts):
       EltTy_(EltTy),
-      NumElts_(NumElts_)
+      NumElts_(NumElts)
     { }
 
     KeyTy(ArrayType const* AT):
@@ -199,14 +204,17 @@ struct DFFICtx
 
   BasicType* getBasicType(DFFIImpl& Dffi, BasicType::BasicKind Kind);
   PointerType* getPtrType(DFFIImpl& Dffi, QualType Pointee);
-  FunctionType* getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC);
+  FunctionType* getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs = false);
+  FunctionType* getFunctionType(DFFIImpl& Dffi, QualType RetTy, llvm::ArrayRef<QualType> ParamsTy, CallingConv CC, bool VarArgs, size_t NFixedParams);
   ArrayType* getArrayType(DFFIImpl& Dffi, QualType EltTy, uint64_t NElements);
+  VectorType* getVectorType(DFFIImpl& Dffi, BasicType const* EltTy, unsigned NElements);
 
 private:
   std::map<BasicType::BasicKind, BasicType> BasicTys_;
   llvm::DenseMap<QualType, std::unique_ptr<PointerType>> PointerTys_;
   llvm::DenseSet<FunctionType*, FunctionTypeKeyInfo> FunctionTys_;
   llvm::DenseSet<ArrayType*, ArrayTypeKeyInfo> ArrayTys_;
+  llvm::DenseMap<std::pair<BasicType const*, unsigned>, std::unique_ptr<VectorType>> VectorTys_;
 };
 
 } // details
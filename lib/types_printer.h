@@ -111,14 +111,20 @@ struct TypePrinter
 
       ss << "(" << CCToClangAttribute(FTy->getCC()) << " " << (Name ? Name:"") << ")";
       ss << "(";
-      if (FTy->getParams().size() > 0) {
-        auto const& Params = FTy->getParams();
-        auto ItLast = --Params.end();
-        for (auto It = Params.begin(); It != ItLast; ++It) {
-          ss << print_def(*It, Full); 
+      // Only the fixed parameters are part of the prototype: the other ones
+      // are the variadic arguments of a call shape.
+      const size_t NFixed = FTy->getNumFixedParams();
+      auto const& Params = FTy->getParams();
+      for (size_t I = 0; I < NFixed; ++I) {
+        if (I > 0) {
           ss << ",";
         }
-        ss << print_def(*ItLast, Full); 
+        ss << print_def(Params[I], Full);
+      }
+      if (FTy->hasVarArgs()) {
+        // (...) isn't a valid C prototype, and such types can't be created
+        assert(NFixed > 0 && "variadic function without fixed parameters!");
+        ss << ",...";
       }
       ss << ")";
       return print_def(FTy->getReturnType(), Full, ss.str().c_str());
@@ -165,6 +171,27 @@ struct TypePrinter
       ss << "[" << ArTy->getNumElements() << "]";
       return ss.str();
     }
+    case dffi::Type::TY_Vector:
+    {
+      // Vector types can only be named through a typedef
+      auto It = NamedTys_.find(Ty);
+      std::string NameTy;
+      if (It != NamedTys_.end()) {
+        NameTy = It->second;
+      }
+      else {
+        auto* VTy = cast<VectorType>(Ty);
+        NameTy = "__dffi_ty_" + std::to_string(NamedTys_.size());
+        NamedTys_.insert(std::make_pair(Ty, NameTy));
+        Decls_ << "typedef " << print_def(VTy->getElementType(), None, NameTy.c_str());
+        Decls_ << " __attribute__((ext_vector_type(" << VTy->getNumElements() << ")));\n";
+      }
+      if (Name) {
+        NameTy += " ";
+        NameTy += Name;
+      }
+      return NameTy;
+    }
     };
   }
 
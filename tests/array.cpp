@@ -16,6 +16,7 @@
 
 #include <iostream>
 #include <dffi/dffi.h>
+#include <dffi/composite_type.h>
 
 using namespace dffi;
 
@@ -42,11 +43,37 @@ struct A init() {
 void print(struct A* a) {
   puts(a->buf);
 }
+struct B
+{
+  char c;
+  double d[2];
+};
+struct C
+{
+  char c;
+  struct B b[2];
+};
 )", Err);
   if (!CU) {
     std::cerr << Err << std::endl;
     return 1;
   }
 
+  // Arrays are aligned on their elements, and so are the structures
+  // containing them
+  auto* BTy = CU.getStructType("B");
+  auto* DTy = BTy->getField("d")->getType();
+  if (DTy->getAlign() != alignof(double) || BTy->getAlign() != alignof(double) ||
+      BTy->getSize() != 3*sizeof(double) || BTy->getField("d")->getOffset() != sizeof(double)) {
+    std::cerr << "invalid layout for struct B!" << std::endl;
+    return 1;
+  }
+  auto* CTy = CU.getStructType("C");
+  if (CTy->getAlign() != alignof(double) || CTy->getSize() != 7*sizeof(double) ||
+      CTy->getField("b")->getOffset() != sizeof(double)) {
+    std::cerr << "invalid layout for struct C!" << std::endl;
+    return 1;
+  }
+
   return 0;
 }
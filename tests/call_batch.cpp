@@ -0,0 +1,89 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/call_batch"
+
+#include <iostream>
+#include <vector>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+double axpy(double a, int x, double y) { return a*x+y; }
+
+static int counter = 0;
+void inc(int v) { counter += v; }
+int get_counter() { return counter; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  const size_t N = 10;
+  auto Axpy = CU.getFunction("axpy");
+  std::vector<ArgsFrame> Frames;
+  std::vector<void*> FramePtrs;
+  for (size_t I = 0; I < N; ++I) {
+    Frames.emplace_back(Axpy.newFrame());
+    Frames.back().set<double>(0, 2.0);
+    Frames.back().set<int>(1, (int)I);
+    Frames.back().set<double>(2, 0.5);
+    FramePtrs.push_back(Frames.back().data());
+  }
+  // Returned values are stored with a stride
+  struct Res { double V; int Pad; };
+  std::vector<Res> Rets(N, Res{0., -1});
+  Axpy.callBatch(&Rets[0].V, sizeof(Res), FramePtrs.data(), N);
+  for (size_t I = 0; I < N; ++I) {
+    if (Rets[I].V != 2.0*I+0.5 || Rets[I].Pad != -1) {
+      std::cerr << "invalid result " << I << ": " << Rets[I].V << std::endl;
+      return 1;
+    }
+  }
+
+  // void functions
+  auto Inc = CU.getFunction("inc");
+  ArgsFrame IncFrame = Inc.newFrame();
+  IncFrame.set<int>(0, 3);
+  std::vector<void*> IncFrames(N, IncFrame.data());
+  Inc.callBatch(nullptr, 0, IncFrames.data(), N);
+  int Counter;
+  CU.getFunction("get_counter").call(&Counter, nullptr);
+  if (Counter != 30) {
+    std::cerr << "invalid counter: " << Counter << std::endl;
+    return 1;
+  }
+
+  // Empty batches
+  Inc.callBatch(nullptr, 0, nullptr, 0);
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RUN: "%build_dir/closure"
+
+#include <iostream>
+#include <vector>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+static void cmp(void* Ctx, void* Ret, void** Args)
+{
+  ++*static_cast<size_t*>(Ctx);
+  int a = **(int const**)Args[0];
+  int b = **(int const**)Args[1];
+  *(int*)Ret = (a > b) - (a < b);
+}
+
+static void add(void* Ctx, void* Ret, void** Args)
+{
+  *(int*)Ret = *(int*)Args[0] + *(int*)Args[1] + *(int*)Ctx;
+}
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+#include <stdlib.h>
+typedef int(*cmp_ty)(const void*, const void*);
+typedef int(*op_ty)(int, int);
+
+void sort(int* a, size_t n, cmp_ty cmp) {
+  qsort(a, n, sizeof(int), cmp);
+}
+
+int call(op_ty f, int a, int b) {
+  return f(a,b);
+}
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  auto* CmpFTy = cast<FunctionType>(cast<PointerType>(CU.getType("cmp_ty"))->getPointee());
+  size_t NCalls = 0;
+  NativeClosure Cmp = CmpFTy->getClosure(cmp, &NCalls);
+
+  int Data[] = {4, 1, 3, 5, 2};
+  int* DataPtr = Data;
+  size_t N = 5;
+  void* CmpPtr = Cmp.getCodePtr();
+  void* SortArgs[] = {&DataPtr, &N, &CmpPtr};
+  CU.getFunction("sort").call(SortArgs);
+  for (int i = 0; i < 5; ++i) {
+    if (Data[i] != i+1) {
+      std::cerr << "sort failed!" << std::endl;
+      return 1;
+    }
+  }
+  if (NCalls == 0) {
+    std::cerr << "comparison closure not called!" << std::endl;
+    return 1;
+  }
+
+  // Allocate more closures than a single pool chunk can hold, and check that
+  // each one uses its own context.
+  auto* OpFTy = cast<FunctionType>(cast<PointerType>(CU.getType("op_ty"))->getPointee());
+  auto Call = CU.getFunction("call");
+  std::vector<int> Ctxs(100);
+  std::vector<NativeClosure> Ops;
+  for (int i = 0; i < 100; ++i) {
+    Ctxs[i] = i;
+    Ops.emplace_back(OpFTy->getClosure(add, &Ctxs[i]));
+  }
+  for (int i = 0; i < 100; ++i) {
+    void* OpPtr = Ops[i].getCodePtr();
+    int a = 1;
+    int b = 2;
+    void* Args[] = {&OpPtr, &a, &b};
+    int Ret;
+    Call.call(&Ret, Args);
+    if (Ret != i+3) {
+      std::cerr << "closure " << i << " returned " << Ret << std::endl;
+      return 1;
+    }
+  }
+
+  // Released closures are reused
+  void* Last = Ops.back().getCodePtr();
+  Ops.pop_back();
+  NativeClosure Op = OpFTy->getClosure(add, &Ctxs[0]);
+  if (Op.getCodePtr() != Last) {
+    std::cerr << "released closure not reused!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RUN: "%build_dir/direct_tramp"
+
+#include <iostream>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+struct Res
+{
+  int a;
+  int b;
+  int res;
+};
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+  Opts.DirectTrampolines = true;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+typedef struct
+{
+  int a;
+  int b;
+  int res;
+} Res;
+
+static int add(int a, int b) {
+  return a+b;
+}
+
+Res get_res(int a, int b) {
+  Res Ret = {a,b,add(a,b)};
+  return Ret;
+}
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  int a = 1;
+  int b = 5;
+  void* Args[] = {&a, &b};
+
+  NativeFunc Add = CU.getFunction("add");
+  int Ret;
+  Add.call(&Ret, Args);
+  if (Ret != 6) {
+    std::cerr << "add failed!" << std::endl;
+    return 1;
+  }
+  // The direct wrapper is used instead of the function type one
+  NativeFunc AddGeneric = Jit.getFunction(Add.getType(), Add.getFuncCodePtr());
+  if (AddGeneric.getTrampPtr() == Add.getTrampPtr()) {
+    std::cerr << "direct wrapper isn't used!" << std::endl;
+    return 1;
+  }
+  AddGeneric.call(&Ret, Args);
+  if (Ret != 6) {
+    std::cerr << "add through its address failed!" << std::endl;
+    return 1;
+  }
+
+  Res R;
+  CU.getFunction("get_res").call(&R, Args);
+  if (R.a != 1 || R.b != 5 || R.res != 6) {
+    std::cerr << "get_res failed!" << std::endl;
+    return 1;
+  }
+
+  // External functions
+  auto CUStd = Jit.cdef("#include <stdlib.h>", nullptr, Err);
+  if (!CUStd) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+  int V = -4;
+  void* AbsArgs[] = {&V};
+  CUStd.getFunction("abs").call(&Ret, AbsArgs);
+  if (Ret != 4) {
+    std::cerr << "abs failed!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/frame_call"
+
+#include <iostream>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+struct Point
+{
+  int x;
+  int y;
+};
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+#include <stdint.h>
+typedef struct {
+  int x;
+  int y;
+} Point;
+
+double mix(char c, double d, short s, Point p, int64_t i) {
+  return c + d + s + p.x*p.y + i;
+}
+void noargs() { }
+int add(int a, int b) { return a+b; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  auto Mix = CU.getFunction("mix");
+  auto Layout = Mix.getType()->getFrameLayout();
+  const uint64_t ExpectedOffsets[] = {0, 8, 16, 20, 32};
+  for (size_t I = 0; I < 5; ++I) {
+    if (Layout.Offsets[I] != ExpectedOffsets[I]) {
+      std::cerr << "invalid offset for argument " << I << ": " << Layout.Offsets[I] << std::endl;
+      return 1;
+    }
+  }
+  if (Layout.Size != 40 || Layout.Align != 8) {
+    std::cerr << "invalid frame layout: " << Layout.Size << "/" << Layout.Align << std::endl;
+    return 1;
+  }
+
+  ArgsFrame Frame = Mix.newFrame();
+  Frame.set<char>(0, 1);
+  Frame.set<double>(1, 2.5);
+  Frame.set<short>(2, 3);
+  Frame.set(3, Point{4, 5});
+  Frame.set<int64_t>(4, 6);
+  double Ret;
+  Mix.callFrame(&Ret, Frame);
+  if (Ret != 32.5) {
+    std::cerr << "invalid result: " << Ret << std::endl;
+    return 1;
+  }
+  // Frames can be reused
+  Frame.set<int64_t>(4, 10);
+  Mix.callFrame(&Ret, Frame);
+  if (Ret != 36.5) {
+    std::cerr << "invalid result with a reused frame: " << Ret << std::endl;
+    return 1;
+  }
+
+  // Contiguous frames
+  std::vector<char> Frames(Layout.Size*2 + Layout.Align);
+  char* Base = (char*)(((uintptr_t)Frames.data() + Layout.Align - 1) & ~(uintptr_t)(Layout.Align - 1));
+  memcpy(Base, Frame.data(), Layout.Size);
+  memcpy(Base + Layout.Size, Frame.data(), Layout.Size);
+  *(double*)(Base + Layout.Size + Layout.Offsets[1]) = 10.5;
+  Mix.callFrame(&Ret, Base + Layout.Size);
+  if (Ret != 44.5) {
+    std::cerr << "invalid result with contiguous frames: " << Ret << std::endl;
+    return 1;
+  }
+
+  auto NoArgs = CU.getFunction("noargs");
+  if (NoArgs.getType()->getFrameLayout().Size != 0) {
+    std::cerr << "invalid empty frame size!" << std::endl;
+    return 1;
+  }
+  NoArgs.callFrame(nullptr, NoArgs.newFrame());
+
+  // The first frame calls of a function can happen in several threads
+  auto Add = CU.getFunction("add");
+  std::vector<int> Rets(4, 0);
+  std::vector<std::thread> Threads;
+  for (int I = 0; I < (int)Rets.size(); ++I) {
+    Threads.emplace_back([&Add, &Rets, I]() {
+      ArgsFrame F = Add.newFrame();
+      F.set<int>(0, I);
+      F.set<int>(1, 10);
+      Add.callFrame(&Rets[I], F);
+    });
+  }
+  for (auto& T: Threads) {
+    T.join();
+  }
+  for (int I = 0; I < (int)Rets.size(); ++I) {
+    if (Rets[I] != I+10) {
+      std::cerr << "invalid result in thread " << I << ": " << Rets[I] << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/openmp"
+// REQUIRES: openmp
+
+#include <iostream>
+#include <vector>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+  Opts.OpenMP = true;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+#include <omp.h>
+#include <stddef.h>
+
+void saxpy(float* y, float const* x, float a, size_t n) {
+  #pragma omp parallel for
+  for (size_t i = 0; i < n; ++i) {
+    y[i] += a*x[i];
+  }
+}
+
+int max_threads() { return omp_get_max_threads(); }
+
+double sum(double const* v, int n) {
+  double ret = 0;
+  #pragma omp parallel for reduction(+:ret)
+  for (int i = 0; i < n; ++i) {
+    ret += v[i];
+  }
+  return ret;
+}
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  // Outlined parallel regions aren't exposed
+  for (auto const& Name: CU.getFunctions()) {
+    if (Name[0] == '.') {
+      std::cerr << "unexpected function " << Name << std::endl;
+      return 1;
+    }
+  }
+
+  if (CU.getFunction("max_threads").callAs<int>() < 1) {
+    std::cerr << "invalid number of threads" << std::endl;
+    return 1;
+  }
+
+  const size_t N = 100000;
+  std::vector<float> X(N), Y(N);
+  for (size_t I = 0; I < N; ++I) {
+    X[I] = I;
+    Y[I] = 1;
+  }
+  CU.getFunction("saxpy").callAs<void>(&Y[0], (float const*)&X[0], 2.f, N);
+  for (size_t I = 0; I < N; ++I) {
+    if (Y[I] != 2.f*I+1) {
+      std::cerr << "invalid value at " << I << ": " << Y[I] << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<double> V(1000, 0.5);
+  double Sum = CU.getFunction("sum").callAs<double>((double const*)&V[0], 1000);
+  if (Sum != 500.) {
+    std::cerr << "invalid sum: " << Sum << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/pgo"
+
+#include <iostream>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+  Opts.ProfileInstrument = true;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+static unsigned calls = 0;
+
+int classify(int v) {
+  ++calls;
+  if (v < 0) return -1;
+  switch (v % 3) {
+    case 0: return 0;
+    case 1: return 10;
+    default: return 20;
+  }
+}
+
+int never_called(int v) { return v; }
+
+unsigned get_calls() { return calls; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  NativeFunc Classify = CU.getFunction("classify");
+  auto Check = [&](unsigned NCalls) {
+    for (int I = 0; I < (int)NCalls; ++I) {
+      int V = I-5;
+      int Expected = V < 0 ? -1 : (V%3)*10;
+      int Ret = Classify.callAs<int>(V);
+      if (Ret != Expected) {
+        std::cerr << "invalid result for " << V << ": " << Ret << std::endl;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (!Check(100)) {
+    return 1;
+  }
+  auto Hot = CU.getHotFunctions();
+  if (Hot.size() != 1 || Hot[0].first != "classify" || Hot[0].second != 100) {
+    std::cerr << "invalid hot functions" << std::endl;
+    return 1;
+  }
+
+  if (!CU.optimizeWithProfile(Err)) {
+    std::cerr << "unable to optimize with profile: " << Err << std::endl;
+    return 1;
+  }
+
+  // The optimized version is used through the same function object, and
+  // shares the global variables of the instrumented one.
+  void* Instrumented = Classify.getFuncCodePtr();
+  if (Classify.getCurrentCodePtr() == Instrumented) {
+    std::cerr << "optimized version isn't used" << std::endl;
+    return 1;
+  }
+  if (!Check(100)) {
+    return 1;
+  }
+  // The optimized version isn't instrumented
+  Hot = CU.getHotFunctions();
+  if (Hot.size() != 1 || Hot[0].second != 100) {
+    std::cerr << "optimized version is instrumented" << std::endl;
+    return 1;
+  }
+  // Calls through the trampoline use it too
+  {
+    int V = 7;
+    int Ret;
+    void* Args[] = {&V};
+    Classify.call(&Ret, Args);
+    if (Ret != 10) {
+      std::cerr << "invalid result through call: " << Ret << std::endl;
+      return 1;
+    }
+  }
+  unsigned Calls = CU.getFunction("get_calls").callAs<unsigned>();
+  if (Calls != 201) {
+    std::cerr << "global variable isn't shared: " << Calls << std::endl;
+    return 1;
+  }
+
+  // Not instrumented
+  CCOpts OptsNoProf;
+  OptsNoProf.OptLevel = 2;
+  DFFI JitNoProf(OptsNoProf);
+  auto CUNoProf = JitNoProf.compile("int f(int a) { return a; }", Err);
+  if (!CUNoProf || CUNoProf.optimizeWithProfile(Err) || !CUNoProf.getHotFunctions().empty()) {
+    std::cerr << "non-instrumented compilation unit can't be optimized with a profile" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RUN: "%build_dir/specialize"
+
+#include <iostream>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+static int host_sub(int a, int b)
+{
+  return a-b;
+}
+
+struct Point
+{
+  int x;
+  int y;
+};
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+  Opts.KeepIR = true;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+typedef struct {
+  int x;
+  int y;
+} Point;
+
+static int counter = 0;
+
+int op(int mode, int x) {
+  ++counter;
+  if (mode == 0) return x+1;
+  return x*2;
+}
+
+int dot(Point a, Point b) {
+  return a.x*b.x + a.y*b.y;
+}
+
+int get_counter() { return counter; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  NativeFunc Op = CU.getFunction("op");
+  int Mode = 1;
+  auto OpMul = Op.specialize({{0, &Mode}}, Err);
+  if (!OpMul) {
+    std::cerr << "specialization failed: " << Err << std::endl;
+    return 1;
+  }
+  if (OpMul.getType()->getParams().size() != 1) {
+    std::cerr << "invalid specialized function type!" << std::endl;
+    return 1;
+  }
+  int X = 5;
+  int Ret;
+  void* Args[] = {&X};
+  OpMul.call(&Ret, Args);
+  if (Ret != 10) {
+    std::cerr << "invalid specialized result: " << Ret << std::endl;
+    return 1;
+  }
+  // Global variables are shared with the original function
+  int Counter;
+  CU.getFunction("get_counter").call(&Counter, nullptr);
+  if (Counter != 1) {
+    std::cerr << "global variable isn't shared: " << Counter << std::endl;
+    return 1;
+  }
+
+  // Structures
+  Point A = {1, 2};
+  auto Dot = CU.getFunction("dot").specialize({{1, &A}}, Err);
+  Point B = {3, 4};
+  void* DotArgs[] = {&B};
+  Dot.call(&Ret, DotArgs);
+  if (Ret != 11) {
+    std::cerr << "invalid specialized dot result: " << Ret << std::endl;
+    return 1;
+  }
+
+  // Functions without IR are called through their address
+  auto Sub = Jit.getFunction(Op.getType(), (void*)&host_sub);
+  int Val = 10;
+  auto SubFrom10 = Sub.specialize({{0, &Val}}, Err);
+  X = 3;
+  SubFrom10.call(&Ret, Args);
+  if (Ret != 7) {
+    std::cerr << "invalid specialized external result: " << Ret << std::endl;
+    return 1;
+  }
+
+  if (Op.specialize({{2, &Mode}}, Err)) {
+    std::cerr << "out of range argument not detected!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -16,6 +16,7 @@
 
 #include <iostream>
 #include <dffi/dffi.h>
+#include <dffi/composite_type.h>
 
 using namespace dffi;
 
@@ -64,6 +65,12 @@ void set(struct A* a) {
     return 1;
   }
 
+  auto* STy = CU.getStructType("A");
+  if (!STy || STy->getName() != "A") {
+    std::cerr << "invalid structure name!" << std::endl;
+    return 1;
+  }
+
   A obj = {1,2,4,5.};
   void* Args[] = {&obj};
   // CHECK: a=1, b=2, c=4, d=5.000000
@@ -0,0 +1,106 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/target_opts"
+
+#include <iostream>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+static const char* Code = R"(
+int fast_math() {
+#ifdef __FAST_MATH__
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+float sum(float const* v, unsigned n) {
+  float ret = 0;
+  for (unsigned i = 0; i < n; ++i) ret += v[i];
+  return ret;
+}
+)";
+
+static int check(CCOpts const& Opts, int FastMath)
+{
+  DFFI Jit(Opts);
+  std::string Err;
+  auto CU = Jit.compile(Code, Err);
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+  int Ret;
+  CU.getFunction("fast_math").call(&Ret, nullptr);
+  if (Ret != FastMath) {
+    std::cerr << "invalid fast math mode!" << std::endl;
+    return 1;
+  }
+  float V[64];
+  for (unsigned I = 0; I < 64; ++I) {
+    V[I] = I;
+  }
+  float* PV = V;
+  unsigned N = 64;
+  void* Args[] = {&PV, &N};
+  float Sum;
+  CU.getFunction("sum").call(&Sum, Args);
+  if (Sum != 2016.f) {
+    std::cerr << "invalid sum: " << Sum << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  // Host CPU
+  CCOpts Opts;
+  Opts.OptLevel = 3;
+  if (check(Opts, 0)) {
+    return 1;
+  }
+
+  Opts.FastMath = true;
+  if (check(Opts, 1)) {
+    return 1;
+  }
+
+  Opts.FastMath = false;
+  Opts.Vectorize = false;
+  Opts.Unroll = false;
+  if (check(Opts, 0)) {
+    return 1;
+  }
+
+#if defined(__x86_64__) || defined(_M_X64)
+  // Generic CPU
+  Opts.CPU = "x86-64";
+  Opts.Features = {"-avx", "-avx2"};
+  Opts.Vectorize = true;
+  if (check(Opts, 0)) {
+    return 1;
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/tiered"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+  Opts.TieredCompilation = true;
+  Opts.TierUpThreshold = 10;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+static unsigned calls = 0;
+static const int weights[] = {1, 2, 3, 4};
+
+static int weight(int i) { return weights[i%4]; }
+
+int sum(int n) {
+  ++calls;
+  int ret = 0;
+  for (int i = 0; i < n; ++i) ret += weight(i);
+  return ret;
+}
+
+unsigned get_calls() { return calls; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  NativeFunc Sum = CU.getFunction("sum");
+  NativeFunc GetCalls = CU.getFunction("get_calls");
+  int N = 10;
+  void* Args[] = {&N};
+  // Results must stay the same while the function is recompiled in the
+  // background, and the optimized version must share the global variables
+  // of the original one.
+  const unsigned NCalls = 2000;
+  for (unsigned I = 0; I < NCalls; ++I) {
+    int Ret;
+    Sum.call(&Ret, Args);
+    if (Ret != 25) {
+      std::cerr << "invalid result at call " << I << ": " << Ret << std::endl;
+      return 1;
+    }
+    if (I % 100 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+  unsigned Calls;
+  GetCalls.call(&Calls, nullptr);
+  if (Calls != NCalls) {
+    std::cerr << "global variable isn't shared: " << Calls << std::endl;
+    return 1;
+  }
+
+  // Frames use the optimized code once it is available
+  for (unsigned I = 0; I < 100 && Sum.getCurrentCodePtr() == Sum.getFuncCodePtr(); ++I) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (Sum.getCurrentCodePtr() == Sum.getFuncCodePtr()) {
+    std::cerr << "function hasn't been tiered up!" << std::endl;
+    return 1;
+  }
+  ArgsFrame Frame = Sum.newFrame();
+  Frame.set(0, N);
+  int FrameRet;
+  Sum.callFrame(&FrameRet, Frame);
+  if (FrameRet != 25) {
+    std::cerr << "invalid result through a frame: " << FrameRet << std::endl;
+    return 1;
+  }
+
+  // Function pointers still work
+  NativeFunc SumGeneric = Jit.getFunction(Sum.getType(), Sum.getFuncCodePtr());
+  int Ret;
+  SumGeneric.call(&Ret, Args);
+  if (Ret != 25) {
+    std::cerr << "invalid result through the function pointer: " << Ret << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RUN: "%build_dir/typed_call"
+
+#include <iostream>
+#include <cstdint>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+struct Point
+{
+  int x;
+  int y;
+};
+
+// Same layout, but not trivially copyable
+struct PointCopy
+{
+  PointCopy(PointCopy const& O): x(O.x), y(O.y) { }
+
+  int x;
+  int y;
+};
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+#include <stdint.h>
+typedef struct {
+  int x;
+  int y;
+} Point;
+
+int add(int a, int b) { return a+b; }
+double scale(double v, float f) { return v*f; }
+uint64_t sum(uint64_t const* v, unsigned n) {
+  uint64_t ret = 0;
+  for (unsigned i = 0; i < n; ++i) ret += v[i];
+  return ret;
+}
+Point swap(Point p) { Point ret = {p.y, p.x}; return ret; }
+void swap_ptr(Point* p) { int x = p->x; p->x = p->y; p->y = x; }
+void set(int* p, int v) { *p = v; }
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  auto* Add = CU.getFunction("add").as<int(int,int)>();
+  if (!Add || Add(1, 2) != 3) {
+    std::cerr << "invalid add!" << std::endl;
+    return 1;
+  }
+  auto* Scale = CU.getFunction("scale").as<double(double,float)>();
+  if (!Scale || Scale(2.0, 4.0f) != 8.0) {
+    std::cerr << "invalid scale!" << std::endl;
+    return 1;
+  }
+  uint64_t Vals[] = {1, 2, 3};
+  auto* Sum = CU.getFunction("sum").as<uint64_t(uint64_t const*, unsigned)>();
+  if (!Sum || Sum(Vals, 3) != 6) {
+    std::cerr << "invalid sum!" << std::endl;
+    return 1;
+  }
+  auto* Swap = CU.getFunction("swap_ptr").as<void(Point*)>();
+  if (!Swap) {
+    std::cerr << "unable to get swap_ptr!" << std::endl;
+    return 1;
+  }
+  Point P{1, 2};
+  Swap(&P);
+  if (P.x != 2 || P.y != 1) {
+    std::cerr << "invalid swap!" << std::endl;
+    return 1;
+  }
+  int V = 0;
+  CU.getFunction("set").callAs<void>(&V, 10);
+  if (V != 10) {
+    std::cerr << "invalid set!" << std::endl;
+    return 1;
+  }
+  // void* is compatible with any pointer
+  if (!CU.getFunction("set").as<void(void*,int)>()) {
+    std::cerr << "void* isn't accepted!" << std::endl;
+    return 1;
+  }
+
+  // Mismatches
+  if (CU.getFunction("add").as<int(int,unsigned)>() ||
+      CU.getFunction("add").as<int(int)>() ||
+      CU.getFunction("add").as<long(int,int)>() ||
+      CU.getFunction("scale").as<double(double,double)>() ||
+      CU.getFunction("sum").as<uint64_t(uint32_t const*, unsigned)>() ||
+      CU.getFunction("set").as<int(int*,int)>() ||
+      // Structures can't be passed by value, and must be trivially copyable
+      CU.getFunction("swap").as<Point(Point)>() ||
+      CU.getFunction("swap_ptr").as<void(PointCopy*)>()) {
+    std::cerr << "signature mismatch not detected!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/varargs"
+
+#include <iostream>
+#include <cstring>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+
+using namespace dffi;
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+#include <stdarg.h>
+
+int sum(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  int ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret += va_arg(args, int);
+  }
+  va_end(args);
+  return ret;
+}
+
+double fsum(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  double ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret += va_arg(args, double);
+  }
+  va_end(args);
+  return ret;
+}
+)",
+  Err);
+
+  if (!CU) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+
+  auto* IntTy = Jit.getInt32Ty();
+  NativeFunc Sum = CU.getFunction("sum");
+  if (!Sum.getType()->hasVarArgs() || Sum.getType()->getNumFixedParams() != 1) {
+    std::cerr << "sum should be variadic!" << std::endl;
+    return 1;
+  }
+  auto Sum3 = Sum.getVarArgsFunction({IntTy, IntTy, IntTy});
+  if (Sum3.getType()->getParams().size() != 4) {
+    std::cerr << "invalid call type!" << std::endl;
+    return 1;
+  }
+  int N = 3, A = 1, B = 2, C = 4;
+  int Ret;
+  void* Args[] = {&N, &A, &B, &C};
+  Sum3.call(&Ret, Args);
+  if (Ret != 7) {
+    std::cerr << "invalid sum: " << Ret << std::endl;
+    return 1;
+  }
+
+  // The same call shape reuses the same trampoline
+  auto Sum3Again = Sum.getVarArgsFunction({IntTy, IntTy, IntTy});
+  if (Sum3Again.getType() != Sum3.getType() || Sum3Again.getTrampPtr() != Sum3.getTrampPtr()) {
+    std::cerr << "call shape isn't cached!" << std::endl;
+    return 1;
+  }
+
+  // Small integers are promoted to int, and floats to double
+  auto* ShortTy = Jit.getBasicType<short>();
+  if (Sum.getVarArgsFunction({ShortTy, IntTy, IntTy}).getType() != Sum3.getType()) {
+    std::cerr << "short isn't promoted to int!" << std::endl;
+    return 1;
+  }
+  NativeFunc FSum = CU.getFunction("fsum");
+  auto FSum2 = FSum.getVarArgsFunction({Jit.getFloat32Ty(), Jit.getFloat64Ty()});
+  if (FSum2.getType()->getParams()[1] != Jit.getFloat64Ty()) {
+    std::cerr << "float isn't promoted to double!" << std::endl;
+    return 1;
+  }
+  int N2 = 2;
+  double FA = 1.5, FB = 2.25, FRet;
+  void* FArgs[] = {&N2, &FA, &FB};
+  FSum2.call(&FRet, FArgs);
+  if (FRet != 3.75) {
+    std::cerr << "invalid fsum: " << FRet << std::endl;
+    return 1;
+  }
+
+  // Variadic functions declared in headers
+  auto CUH = Jit.cdef("#include <stdio.h>", nullptr, Err);
+  if (!CUH) {
+    std::cerr << "Compile error: " << Err << std::endl;
+    return 1;
+  }
+  NativeFunc Snprintf = CUH.getFunction("snprintf");
+  if (!Snprintf) {
+    std::cerr << "snprintf not found!" << std::endl;
+    return 1;
+  }
+  auto SnprintfID = Snprintf.getVarArgsFunction({IntTy, Jit.getFloat64Ty(), Jit.getCharPtrTy()});
+  char Buf[64];
+  char* BufPtr = Buf;
+  size_t Size = sizeof(Buf);
+  const char* Fmt = "%d %.2f %s";
+  int V = 42;
+  double D = 1.5;
+  const char* S = "dffi";
+  void* PArgs[] = {&BufPtr, &Size, &Fmt, &V, &D, &S};
+  SnprintfID.call(&Ret, PArgs);
+  if (strcmp(Buf, "42 1.50 dffi") != 0) {
+    std::cerr << "invalid snprintf output: " << Buf << std::endl;
+    return 1;
+  }
+
+  // C variadic functions need at least one fixed parameter
+  if (Jit.getFunctionType(IntTy, {}, CC_C, true)) {
+    std::cerr << "variadic function type without fixed parameters!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
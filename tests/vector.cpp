@@ -0,0 +1,120 @@
+// Copyright 2018 Adrien Guinet <adrien@guinet.me>
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RUN: "%build_dir/vector"
+
+#include <iostream>
+#include <dffi/dffi.h>
+#include <dffi/types.h>
+#include <dffi/composite_type.h>
+
+using namespace dffi;
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+
+int main(int argc, char** argv)
+{
+  DFFI::initialize();
+
+  CCOpts Opts;
+  Opts.OptLevel = 2;
+
+  DFFI Jit(Opts);
+
+  std::string Err;
+  auto CU = Jit.compile(R"(
+typedef float v4f __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+typedef int v3i __attribute__((ext_vector_type(3)));
+
+v4f fma4(v4f a, v4f b, v4f c) { return a*b + c; }
+v4d scale(v4d v, double s) { return v*s; }
+int sum3(v3i v) { return v[0] + v[1] + v[2]; }
+
+struct S {
+  char c;
+  v4f v;
+};
+float lane(struct S const* s, int i) { return s->v[i]; }
+)", Err);
+  if (!CU) {
+    std::cerr << Err << std::endl;
+    return 1;
+  }
+
+  auto* FmaTy = CU.getFunction("fma4").getType();
+  auto* V4FTy = dyn_cast<VectorType>(FmaTy->getReturnType());
+  if (!V4FTy || V4FTy->getNumElements() != 4 || V4FTy->getElementType() != Jit.getFloat32Ty() ||
+      V4FTy->getSize() != 16 || V4FTy->getAlign() != 16) {
+    std::cerr << "invalid vector type" << std::endl;
+    return 1;
+  }
+  if (V4FTy != Jit.getVectorType(Jit.getFloat32Ty(), 4)) {
+    std::cerr << "vector types aren't unique" << std::endl;
+    return 1;
+  }
+
+  v4f A = {1, 2, 3, 4};
+  v4f B = {2, 2, 2, 2};
+  v4f C = {1, 1, 1, 1};
+  v4f R;
+  void* Args[] = {&A, &B, &C};
+  CU.getFunction("fma4").call(&R, Args);
+  for (int I = 0; I < 4; ++I) {
+    if (R[I] != A[I]*2+1) {
+      std::cerr << "invalid fma4 lane " << I << ": " << R[I] << std::endl;
+      return 1;
+    }
+  }
+
+  v4d D = {1, 2, 3, 4};
+  double S = 0.5;
+  v4d RD;
+  void* ArgsD[] = {&D, &S};
+  CU.getFunction("scale").call(&RD, ArgsD);
+  for (int I = 0; I < 4; ++I) {
+    if (RD[I] != D[I]*0.5) {
+      std::cerr << "invalid scale lane " << I << ": " << RD[I] << std::endl;
+      return 1;
+    }
+  }
+
+  // Vectors of 3 elements have the size of 4 ones
+  auto* V3ITy = cast<VectorType>(CU.getFunction("sum3").getType()->getParams()[0].getType());
+  if (V3ITy->getNumElements() != 3 || V3ITy->getSize() != 16) {
+    std::cerr << "invalid 3-element vector type" << std::endl;
+    return 1;
+  }
+  alignas(16) int V3[4] = {1, 2, 3, 0};
+  int Sum;
+  void* ArgsS[] = {&V3[0]};
+  CU.getFunction("sum3").call(&Sum, ArgsS);
+  if (Sum != 6) {
+    std::cerr << "invalid sum3: " << Sum << std::endl;
+    return 1;
+  }
+
+  // Vector fields
+  auto* STy = CU.getStructType("S");
+  auto* VField = STy->getField("v");
+  if (!VField || VField->getOffset() != 16 || !isa<VectorType>(VField->getType()) || STy->getAlign() != 16) {
+    std::cerr << "invalid structure layout" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}